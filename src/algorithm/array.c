@@ -73,12 +73,12 @@ int array_delete(array_t *arr, int index)
         {
             if(i != index)
             {
-                arr->table[j] = old_table[j];
+                arr->table[j] = old_table[i];
                 j ++ ;
             }
         }
-        arr->count ++ ;
-        free_table(old_table);
+        arr->count -= 1;
+        free(old_table);
         return SUCCESS;
     }
     else // don't need to shrink 
@@ -20,19 +20,25 @@ void add_cleanup_event(void *func) // 增加一个函数指针
     }
     
     // fill in the first event
-    array_insert(&events, (uint64_t)func); // 将函数func的地址放入array
+    array_insert(events, (uint64_t)func); // 将函数func的地址放入array
     return ;
 }
 
 void finally_cleanup()
 {
+    if(events == NULL)
+    {
+        // no event was added
+        return;
+    }
+
     for(int i = 0; i < events->count; i ++ )
     {
         uint64_t address;
         assert(array_get(events, i, &address) != 0);
 
         cleanup_t *func;
-        *(uint64_t *)&func = address;
+        func = (cleanup_t *)address;
         (*func)();
     }
 
@@ -0,0 +1,397 @@
+// memory access trace reader
+// the trace is mapped into the address space of the simulator instead of fgets() line by line,
+// so that multi-GB traces are parsed at memory bandwidth rather than at stdio speed
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <headers/trace.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#define TRACE_ADDRESS_MASK  ((((uint64_t)1) << TRACE_ADDRESS_LENGTH) - 1)
+
+trace_t *trace_open(const char *filename)
+{
+    trace_t *t = calloc(1, sizeof(trace_t));
+    assert(t != NULL);
+
+    t->fd = open(filename, O_RDONLY);
+    if(t->fd < 0)
+    {
+        printf("trace: can not open %s\n", filename);
+        exit(0);
+    }
+
+    struct stat st;
+    if(fstat(t->fd, &st) != 0)
+    {
+        printf("trace: can not stat %s\n", filename);
+        exit(0);
+    }
+    t->length = st.st_size;
+
+    // mmap() of an empty file fails, an empty trace is simply empty
+    if(t->length > 0)
+    {
+        void *base = mmap(NULL, t->length, PROT_READ, MAP_PRIVATE, t->fd, 0);
+        if(base == MAP_FAILED)
+        {
+            printf("trace: can not mmap %s\n", filename);
+            exit(0);
+        }
+        // the trace is scanned once from head to tail
+        madvise(base, t->length, MADV_SEQUENTIAL | MADV_WILLNEED);
+        t->base = base;
+    }
+
+    if(t->length >= TRACE_BINARY_MAGIC_SIZE &&
+        memcmp(t->base, TRACE_BINARY_MAGIC, TRACE_BINARY_MAGIC_SIZE) == 0)
+    {
+        t->format = TRACE_FORMAT_BINARY;
+        if((t->length - TRACE_BINARY_MAGIC_SIZE) % sizeof(uint64_t) != 0)
+        {
+            printf("trace: binary trace %s is truncated\n", filename);
+            exit(0);
+        }
+    }
+    else
+    {
+        t->format = TRACE_FORMAT_LACKEY;
+    }
+
+    trace_rewind(t);
+    return t;
+}
+
+void trace_close(trace_t *t)
+{
+    if(t == NULL)
+    {
+        return;
+    }
+    if(t->base != NULL)
+    {
+        munmap((void *)t->base, t->length);
+    }
+    close(t->fd);
+    free(t);
+}
+
+void trace_rewind(trace_t *t)
+{
+    t->pos = (t->format == TRACE_FORMAT_BINARY) ? TRACE_BINARY_MAGIC_SIZE : 0;
+    t->line = 1;
+}
+
+/*======================================*/
+/*      binary traces                   */
+/*======================================*/
+
+static uint64_t read_binary(trace_t *t, trace_record_t *records, uint64_t max)
+{
+    uint64_t count = (t->length - t->pos) / sizeof(uint64_t);
+    if(count > max)
+    {
+        count = max;
+    }
+
+    const char *p = t->base + t->pos;
+    for(uint64_t i = 0; i < count; i ++ )
+    {
+        uint64_t v;
+        memcpy(&v, p + i * sizeof(uint64_t), sizeof(uint64_t));
+
+        if(((v >> 56) & 0xf) > TRACE_OP_MODIFY)
+        {
+            printf("trace: bad binary record 0x%016lx at byte %lu\n", v, t->pos + i * sizeof(uint64_t));
+            exit(0);
+        }
+
+        records[i].addr = v & TRACE_ADDRESS_MASK;
+        records[i].size = (v >> 48) & 0xff;
+        records[i].op   = (v >> 56) & 0xf;
+        records[i].requester = v >> 60;
+    }
+
+    t->pos += count * sizeof(uint64_t);
+    return count;
+}
+
+void trace_write_binary_header(FILE *fw)
+{
+    if(fwrite(TRACE_BINARY_MAGIC, 1, TRACE_BINARY_MAGIC_SIZE, fw) != TRACE_BINARY_MAGIC_SIZE)
+    {
+        printf("trace: can not write the binary trace\n");
+        exit(0);
+    }
+}
+
+void trace_write_binary(FILE *fw, const trace_record_t *records, uint64_t count)
+{
+    uint64_t buf[1024];
+
+    while(count > 0)
+    {
+        uint64_t n = count < 1024 ? count : 1024;
+        for(uint64_t i = 0; i < n; i ++ )
+        {
+            // a binary record has 48 bits of address, the round trip must not lose the rest
+            if((records[i].addr & ~TRACE_ADDRESS_MASK) != 0)
+            {
+                printf("trace: bad address 0x%lx for a binary record, at most %d bits\n",
+                    records[i].addr, TRACE_ADDRESS_LENGTH);
+                exit(0);
+            }
+            buf[i] = records[i].addr |
+                ((uint64_t)records[i].size << 48) |
+                ((uint64_t)(records[i].op & 0xf) << 56) |
+                ((uint64_t)(records[i].requester & 0xf) << 60);
+        }
+        if(fwrite(buf, sizeof(uint64_t), n, fw) != n)
+        {
+            printf("trace: can not write the binary trace\n");
+            exit(0);
+        }
+
+        records += n;
+        count -= n;
+    }
+}
+
+/*======================================*/
+/*      lackey text traces              */
+/*======================================*/
+
+static inline int hex_value(char c)
+{
+    if(c >= '0' && c <= '9')
+    {
+        return c - '0';
+    }
+    c |= 0x20; // to lower case
+    if(c >= 'a' && c <= 'f')
+    {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// parse the hex digits at p, return the number of digits
+static inline int parse_hex(const char *p, const char *end, uint64_t *value)
+{
+#ifdef __SSE2__
+    if(end - p >= 16)
+    {
+        // all 16 bytes are converted to nibbles at once
+        __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+        __m128i is_digit = _mm_and_si128(
+            _mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+            _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+        __m128i lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+        __m128i is_alpha = _mm_and_si128(
+            _mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+            _mm_cmplt_epi8(lower, _mm_set1_epi8('f' + 1)));
+
+        __m128i nibble = _mm_or_si128(
+            _mm_and_si128(is_digit, _mm_sub_epi8(v, _mm_set1_epi8('0'))),
+            _mm_and_si128(is_alpha, _mm_sub_epi8(lower, _mm_set1_epi8('a' - 10))));
+
+        // the first non-hex byte terminates the number
+        uint32_t valid = _mm_movemask_epi8(_mm_or_si128(is_digit, is_alpha));
+        int n = __builtin_ctz(~valid);   // at most 16
+
+        if(n > 0 && (n < 16 || end - p == 16 || hex_value(p[16]) < 0))
+        {
+            // clear the bytes after the number, the n digits stay left aligned
+            __m128i index = _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+            nibble = _mm_and_si128(nibble, _mm_cmpgt_epi8(_mm_set1_epi8(n), index));
+
+            // combine nibble pairs into bytes: (r[2k] << 4) | r[2k + 1]
+            __m128i hi = _mm_slli_epi16(_mm_and_si128(nibble, _mm_set1_epi16(0x00ff)), 4);
+            __m128i lo = _mm_srli_epi16(nibble, 8);
+            __m128i packed = _mm_packus_epi16(_mm_or_si128(hi, lo), _mm_setzero_si128());
+
+            // the most significant byte comes first, drop the 16 - n zero nibbles at the tail
+            uint64_t x = __builtin_bswap64((uint64_t)_mm_cvtsi128_si64(packed));
+            *value = x >> (4 * (16 - n));
+            return n;
+        }
+        // more than 16 digits: overflow, handled by the scalar loop
+    }
+#endif
+    uint64_t x = 0;
+    int n = 0;
+    while(p + n < end)
+    {
+        int h = hex_value(p[n]);
+        if(h < 0)
+        {
+            break;
+        }
+        x = (x << 4) | h;
+        n ++ ;
+    }
+    *value = x;
+    return n;
+}
+
+static inline const char *skip_line(const char *p, const char *end)
+{
+    const char *nl = memchr(p, '\n', end - p);
+    return nl == NULL ? end : nl + 1;
+}
+
+// 'I', 'L', 'S', 'M' -> trace_op_t, others -> -1
+static int8_t lackey_op_table[256];
+
+static void init_lackey_op_table()
+{
+    memset(lackey_op_table, -1, sizeof(lackey_op_table));
+    lackey_op_table['I'] = TRACE_OP_INST;
+    lackey_op_table['L'] = TRACE_OP_LOAD;
+    lackey_op_table['S'] = TRACE_OP_STORE;
+    lackey_op_table['M'] = TRACE_OP_MODIFY;
+}
+
+// bytes of one well formed line never exceed this, lines near the end of file
+// are parsed by the careful path which checks the bounds on every byte
+#define LACKEY_FAST_PATH_BYTES (64)
+
+static uint64_t read_lackey(trace_t *t, trace_record_t *records, uint64_t max)
+{
+    const char *p = t->base + t->pos;
+    const char *end = t->base + t->length;
+    uint64_t count = 0;
+
+    if(lackey_op_table[0] == 0)
+    {
+        init_lackey_op_table();
+    }
+
+    while(count < max && p < end)
+    {
+        const char *line = p;
+        trace_record_t *r = &records[count];
+
+        if(end - p >= LACKEY_FAST_PATH_BYTES)
+        {
+            // " L 04f6b868,8" or "I  0400d7d4,8": the spaces are skipped without branches
+            p += (*p == ' ');
+            int op = lackey_op_table[(uint8_t)*p];
+            if(op >= 0 && p[1] == ' ')
+            {
+                p += 2;
+                p += (*p == ' ');
+
+                int n = parse_hex(p, end, &r->addr);
+                if(n > 0 && n <= 16 && p[n] == ',')
+                {
+                    p += n + 1;
+
+                    // size has 1 or 2 digits
+                    uint32_t d0 = (uint8_t)p[0] - '0', d1 = (uint8_t)p[1] - '0';
+                    if(d0 < 10 && (d1 >= 10 || (uint8_t)p[2] - '0' >= 10))
+                    {
+                        int two = d1 < 10;
+                        r->size = two ? d0 * 10 + d1 : d0;
+                        p += 1 + two;
+
+                        if(*p == '\n')
+                        {
+                            r->op = op;
+                            r->requester = 0;
+                            p ++ ;
+                            t->line ++ ;
+                            count ++ ;
+                            continue;
+                        }
+                    }
+                }
+            }
+            // anything unusual goes to the careful path
+            p = line;
+        }
+
+        while(p < end && *p == ' ')
+        {
+            p ++ ;
+        }
+        if(p >= end)
+        {
+            break;
+        }
+
+        int op = lackey_op_table[(uint8_t)*p];
+        if(op < 0)
+        {
+            // banner or empty line
+            p = skip_line(p, end);
+            t->line ++ ;
+            continue;
+        }
+        r->op = op;
+        r->requester = 0;
+        p ++ ;
+
+        while(p < end && *p == ' ')
+        {
+            p ++ ;
+        }
+
+        int n = parse_hex(p, end, &r->addr);
+        if(n == 0 || n > 16 || p + n >= end || p[n] != ',')
+        {
+            printf("trace: bad lackey record at line %lu: %.*s\n", t->line,
+                (int)(skip_line(line, end) - line), line);
+            exit(0);
+        }
+        p += n + 1;
+
+        // the size of a record is one byte
+        uint32_t size = 0;
+        while(p < end && *p >= '0' && *p <= '9' && size <= 0xff)
+        {
+            size = size * 10 + (*p - '0');
+            p ++ ;
+        }
+        if(size > 0xff)
+        {
+            printf("trace: bad lackey record at line %lu: %.*s\n", t->line,
+                (int)(skip_line(line, end) - line), line);
+            exit(0);
+        }
+        r->size = size;
+
+        // \n, \r\n or trailing characters
+        p = skip_line(p, end);
+
+        t->line ++ ;
+        count ++ ;
+    }
+
+    t->pos = p - t->base;
+    return count;
+}
+
+uint64_t trace_read(trace_t *t, trace_record_t *records, uint64_t max)
+{
+    if(t->pos >= t->length)
+    {
+        return 0;
+    }
+    if(t->format == TRACE_FORMAT_BINARY)
+    {
+        return read_binary(t, records, max);
+    }
+    return read_lackey(t, records, max);
+}
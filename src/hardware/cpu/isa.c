@@ -9,6 +9,12 @@
 #include <headers/common.h>
 #include <headers/memory.h>
 #include <headers/instruction.h>
+
+// cpu states shared by all hardware units (declared in cpu.h)
+cpu_reg_t   cpu_reg;
+cpu_flags_t cpu_flags;
+cpu_pc_t    cpu_pc;
+cpu_cr_t    cpu_controls;
  
 /*====================================*/
 /*      pase assembly instruction     */
@@ -562,7 +568,7 @@ static void mov_handler(od_t *src_od, od_t *dst_od)
     {
         // src: register
         // dst: virtual address
-        cpu_write64bits_dram(va2pa(dst), *(uint64_t *)src);
+        va_write64(dst, *(uint64_t *)src);
         increase_pc();
         reset_cflags();
         return ;
@@ -571,7 +577,7 @@ static void mov_handler(od_t *src_od, od_t *dst_od)
     {
         // src: virtual address
         // dst: register
-        *(uint64_t *)dst = cpu_read64bits_dram(va2pa(src));
+        *(uint64_t *)dst = va_read64(src);
         increase_pc();
         reset_cflags();
         return ;
@@ -596,7 +602,7 @@ static void push_handler(od_t *src_od, od_t *dst_od)
         // dst: empty
         cpu_reg.rsp = cpu_reg.rsp - 8;
         // do not write:cpu_reg.rsp  **bug**
-        cpu_write64bits_dram(va2pa(cpu_reg.rsp), *(uint64_t *)src);
+        va_write64(cpu_reg.rsp, *(uint64_t *)src);
         increase_pc();
         reset_cflags();
         return ;
@@ -611,7 +617,7 @@ static void pop_handler(od_t *src_od, od_t *dst_od)
     {
         // src: register
         // dst: empty
-        uint64_t old_val = cpu_read64bits_dram(va2pa(cpu_reg.rsp));
+        uint64_t old_val = va_read64(cpu_reg.rsp);
         cpu_reg.rsp = cpu_reg.rsp + 8;
         *(uint64_t *)src = old_val;
         increase_pc();
@@ -628,7 +634,7 @@ static void leave_handler(od_t *src_od, od_t *dst_od)
     // 1. moveq %rbp,%rsp
     // 2. pop %rbp
     cpu_reg.rsp = cpu_reg.rbp;         
-    uint64_t old_val = cpu_read64bits_dram(va2pa(cpu_reg.rsp));
+    uint64_t old_val = va_read64(cpu_reg.rsp);
     cpu_reg.rbp = old_val;
     cpu_reg.rsp = cpu_reg.rsp + 8;      
     increase_pc();
@@ -648,7 +654,7 @@ static void call_handler(od_t *src_od, od_t *dst_od)
     
     // push the return value
     cpu_reg.rsp = cpu_reg.rsp - 8;
-    cpu_write64bits_dram(va2pa(cpu_reg.rsp), cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
+    va_write64(cpu_reg.rsp, cpu_pc.rip + sizeof(char) * MAX_INSTRUCTION_CHAR);
 
     // jump to target function address
     // TODO: support PC relative addressing
@@ -662,7 +668,7 @@ static void ret_handler(od_t *src_od, od_t *dst_od)
     // dst: empty
     
     // pop rsp
-    uint64_t ret_addr = cpu_read64bits_dram(va2pa(cpu_reg.rsp));
+    uint64_t ret_addr = va_read64(cpu_reg.rsp);
     (cpu_reg.rsp) = cpu_reg.rsp + 8; /* debug 2 hour because I forget to add that sentense, why didn't change rsp when you got ret_addr*/
     cpu_pc.rip = ret_addr;
     reset_cflags();
@@ -739,7 +745,7 @@ static void cmp_handler(od_t *src_od, od_t *dst_od)
         // src: immediate
         // dst: access memory
         // cmp src dst --> dst-src --> s2+(-s1)
-        uint64_t dval = cpu_read64bits_dram(va2pa(dst));
+        uint64_t dval = va_read64(dst);
         uint64_t val = dval + (~src + 1);
 
         int val_sign = ((val  >> 63) & 0x1);
@@ -800,7 +806,7 @@ void instruction_cycle()
 
     // FETCH: get the instruction string by program counter
     char inst_str[MAX_INSTRUCTION_CHAR + 10];
-    cpu_readinst_dram(va2pa(cpu_pc.rip), inst_str);
+    cpu_readinst_dram(va2pa_inst(cpu_pc.rip), inst_str);
 
 #ifdef DEBUG_INSTRUCTION_CYCLE
     printf("%8lx        %s\n", cpu_pc.rip, inst_str);
@@ -1350,11 +1356,11 @@ static void TestAddFunctionCallAndComputation()
     cpu_reg.rbp = 0x7ffffffee110;
     cpu_reg.rsp = 0x7ffffffee0f0;
 
-    cpu_write64bits_dram(va2pa(0x7ffffffee110), 0x0000000000000000);    // rbp
-    cpu_write64bits_dram(va2pa(0x7ffffffee108), 0x0000000000000000);
-    cpu_write64bits_dram(va2pa(0x7ffffffee100), 0x0000000012340000);
-    cpu_write64bits_dram(va2pa(0x7ffffffee0f8), 0x000000000000abcd);
-    cpu_write64bits_dram(va2pa(0x7ffffffee0f0), 0x0000000000000000);    // rsp
+    va_write64(0x7ffffffee110, 0x0000000000000000);    // rbp
+    va_write64(0x7ffffffee108, 0x0000000000000000);
+    va_write64(0x7ffffffee100, 0x0000000012340000);
+    va_write64(0x7ffffffee0f8, 0x000000000000abcd);
+    va_write64(0x7ffffffee0f0, 0x0000000000000000);    // rsp
 
     // 2 before call
     // 3 after call before push
@@ -1380,11 +1386,8 @@ static void TestAddFunctionCallAndComputation()
         "mov    %rax,-0x8(%rbp)",   // 14
     };
 
-    // copy to physical memory
-    for (int i = 0; i < 15; ++ i)
-    {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
-    }
+    // copy to physical memory, the instructions are MAX_INSTRUCTION_CHAR apart
+    va_copy_to(0x00400000, assembly, sizeof(assembly));
     cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 11 + 0x00400000;
 
     printf("begin\n");
@@ -1409,11 +1412,11 @@ static void TestAddFunctionCallAndComputation()
     assert(cpu_reg.rbp == 0x7ffffffee110);
     assert(cpu_reg.rsp == 0x7ffffffee0f0);
 
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee110)) == 0x0000000000000000); // rbp
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee108)) == 0x000000001234abcd);
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee100)) == 0x0000000012340000);
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee0f8)) == 0x000000000000abcd);
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee0f0)) == 0x0000000000000000); // rsp
+    assert(va_read64(0x7ffffffee110) == 0x0000000000000000); // rbp
+    assert(va_read64(0x7ffffffee108) == 0x000000001234abcd);
+    assert(va_read64(0x7ffffffee100) == 0x0000000012340000);
+    assert(va_read64(0x7ffffffee0f8) == 0x000000000000abcd);
+    assert(va_read64(0x7ffffffee0f0) == 0x0000000000000000); // rsp
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
@@ -1434,9 +1437,9 @@ static void TestSumRecursiveCondition()
 
     cpu_flags.__flags_value = 0;
 
-    cpu_write64bits_dram(va2pa(0x7ffffffee230), 0x0000000008000650);    // rbp
-    cpu_write64bits_dram(va2pa(0x7ffffffee228), 0x0000000000000000);
-    cpu_write64bits_dram(va2pa(0x7ffffffee220), 0x00007ffffffee310);    // rsp
+    va_write64(0x7ffffffee230, 0x0000000008000650);    // rbp
+    va_write64(0x7ffffffee228, 0x0000000000000000);
+    va_write64(0x7ffffffee220, 0x00007ffffffee310);    // rsp
 
     char assembly[19][MAX_INSTRUCTION_CHAR] = {
         "push   %rbp",              // 0
@@ -1460,11 +1463,8 @@ static void TestSumRecursiveCondition()
         "mov    %rax,-0x8(%rbp)",   // 18
     };
 
-    // copy to physical memory
-    for (int i = 0; i < 19; ++ i)
-    {
-        cpu_writeinst_dram(va2pa(i * 0x40 + 0x00400000), assembly[i]);
-    }
+    // copy to physical memory, the instructions are MAX_INSTRUCTION_CHAR apart
+    va_copy_to(0x00400000, assembly, sizeof(assembly));
     cpu_pc.rip = MAX_INSTRUCTION_CHAR * sizeof(char) * 16 + 0x00400000;
 
     printf("begin\n");
@@ -1489,18 +1489,30 @@ static void TestSumRecursiveCondition()
     assert(cpu_reg.rdi == 0x0);
     assert(cpu_reg.rbp == 0x7ffffffee230);
     assert(cpu_reg.rsp == 0x7ffffffee220);
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee230)) == 0x0000000008000650); // rbp
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee228)) == 0x0000000000000006);
-    assert(cpu_read64bits_dram(va2pa(0x7ffffffee220)) == 0x00007ffffffee310); // rsp
+    assert(va_read64(0x7ffffffee230) == 0x0000000008000650); // rbp
+    assert(va_read64(0x7ffffffee228) == 0x0000000000000006);
+    assert(va_read64(0x7ffffffee220) == 0x00007ffffffee310); // rsp
 
     printf("\033[32;1m\tPass\033[0m\n");
 }
 
 int main()
 {
+#ifdef DEBUG_MEMORY_PROFILE
+    // windows of 64 accesses, the 16 hottest lines
+    memory_profile_enable(64, 16);
+#endif
+
     TestAddFunctionCallAndComputation();
     TestSumRecursiveCondition();
 
+    mmu_print(stdout);
+
+#ifdef DEBUG_MEMORY_PROFILE
+    memory_profile_write_csv("./bin/profile");
+    memory_profile_disable();
+#endif
+
     finally_cleanup();
     return 0;
 }
@@ -2,151 +2,1023 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <time.h>
 #include <assert.h>
 #include <headers/common.h>
 #include <headers/cpu.h>
 #include <headers/memory.h>
 #include <headers/address.h>
 
-/* ++++++++++++++ TLB CACHE struct +++++++++++ */
-#define NUM_TLB_CACHE_LINE_PRE_SET (8)
+static uint64_t page_walk(uint64_t vaddr_value, page_size_t *page_size);
+static void page_fault_handler(pte4_t *pet, address_t vaddr); 
+static void huge_page_fault(pte123_t *pte, address_t vaddr, page_size_t page_size);
+
+int swap_in(uint64_t daddr, uint64_t ppn);
+int swap_out(uint64_t daddr, uint64_t ppn);
+uint64_t swap_alloc();
+
+/* ++++++++++++++ TLB hierarchy +++++++++++ */
+// instruction fetch looks up the iTLB, operands the dTLB, and both miss to the unified STLB,
+// which misses to the page walk. a translation found in the STLB or by the walk is filled
+// into the STLB and into the L1 TLB which missed.
+// each level keeps the pages of each size apart, and looks them up all at once. a huge page
+// entry is tagged by the vpn bits above the page and holds the first ppn of the page.
+// the default geometry is about the one of Skylake (entries, ways):
+//          4KB         2MB         1GB
+//   iTLB   128 8-way   8 full      4 full
+//   dTLB   64 4-way    32 4-way    4 full
+//   STLB   1536 12-way 128 8-way   16 4-way
+static int tlb_geometries[NUM_MMU_TLBS][NUM_PAGE_SIZES][2] = {
+    [MMU_ITLB] = {{4, 8}, {0, 8}, {0, 4}},
+    [MMU_DTLB] = {{4, 4}, {3, 4}, {0, 4}},
+    [MMU_STLB] = {{7, 12}, {4, 8}, {2, 4}},
+};
+static uint64_t tlb_latencies[NUM_MMU_TLBS] = {
+    [MMU_ITLB] = 1,
+    [MMU_DTLB] = 1,
+    [MMU_STLB] = 9,
+};
+static uint64_t walk_step_latency = 8;   // one level of the page table
+
+// the low bits of the vpn inside a page of each size
+static const int page_size_shifts[NUM_PAGE_SIZES] = {
+    [PAGE_4K] = 0,
+    [PAGE_2M] = VIRTUAL_PAGE_NUMBER_LENGTH,
+    [PAGE_1G] = 2 * VIRTUAL_PAGE_NUMBER_LENGTH,
+};
+
+mmu_stats_t mmu_stats;
+
+/* the page walk cache (paging structure cache) keeps the entries of the upper levels
+    of the page table, the key is the prefix of the virtual address they translate:
+        PML4 cache: vpn1                -> pud
+        PDPT cache: vpn1:vpn2           -> pmd
+        PDE cache:  vpn1:vpn2:vpn3      -> pt
+    a walk starts from the deepest hit and skips the levels above it. these are TLBs (tlb.c)
+    whose vpn is the prefix and whose ppn is the address of the next level table
+*/
+// fully associative, the sizes of Intel's caches: 2 PML4, 4 PDPT and 32 PDE entries
+static int pwc_geometries[NUM_MMU_PWCS][2] = {
+    [MMU_PWC_PML4] = {0, 2},
+    [MMU_PWC_PDPT] = {0, 4},
+    [MMU_PWC_PDE]  = {0, 32},
+};
+
+// the bits of the virtual address above the entry of each cache
+static const int pwc_shifts[NUM_MMU_PWCS] = {
+    [MMU_PWC_PML4] = VIRTUAL_PAGE_OFFSET_LENGTH + 3 * VIRTUAL_PAGE_NUMBER_LENGTH,
+    [MMU_PWC_PDPT] = VIRTUAL_PAGE_OFFSET_LENGTH + 2 * VIRTUAL_PAGE_NUMBER_LENGTH,
+    [MMU_PWC_PDE]  = VIRTUAL_PAGE_OFFSET_LENGTH + 1 * VIRTUAL_PAGE_NUMBER_LENGTH,
+};
+
+/* ++++++++++++++ cores +++++++++++ */
+// each core has its own TLBs, page walk caches and ASIDs (see mmu_write_cr3), all of the same
+// geometry. the cores run one at a time: the translations go through the running core, and
+// cpu_controls.cr3 is its CR3, the others keep theirs here
+#define MAX_ASIDS   (4096)      // the 12 bits of a PCID
 
-typedef struct // cache 行
+typedef struct
 {
-    int valid;      // valid -> 1, invalid -> 0
-    uint64_t tag;
+    tlb_t *tlbs[NUM_MMU_TLBS][NUM_PAGE_SIZES];
+    tlb_t *pwcs[NUM_MMU_PWCS];
+
+    int current_asid;           // the ASID the TLBs look up and fill
+    uint64_t asid_cr3s[MAX_ASIDS];
+    uint64_t asid_times[MAX_ASIDS];     // LRU stamp, 0 for a free ASID
+    uint64_t asid_clock;
+
+    uint64_t cr3;               // while the core is not running
+} mmu_core_t;
+
+static mmu_core_t *cores[MMU_MAX_CORES];
+static int num_cores = 1;
+static int running_core = 0;
+
+static mmu_core_t *core_of(int id)
+{
+    assert(id >= 0 && id < MMU_MAX_CORES);
+    if(cores[id] == NULL)
+    {
+        cores[id] = calloc(1, sizeof(mmu_core_t));
+        assert(cores[id] != NULL);
+    }
+    return cores[id];
+}
+
+static tlb_t *core_tlb(mmu_core_t *c, mmu_tlb_level_t level, page_size_t page_size)
+{
+    if(c->tlbs[level][page_size] == NULL)
+    {
+        c->tlbs[level][page_size] = tlb_construct(
+            tlb_geometries[level][page_size][0], tlb_geometries[level][page_size][1]);
+        tlb_set_asid(c->tlbs[level][page_size], c->current_asid);
+    }
+    return c->tlbs[level][page_size];
+}
+
+static tlb_t *core_pwc(mmu_core_t *c, mmu_pwc_level_t level)
+{
+    if(c->pwcs[level] == NULL)
+    {
+        c->pwcs[level] = tlb_construct(pwc_geometries[level][0], pwc_geometries[level][1]);
+        tlb_set_asid(c->pwcs[level], c->current_asid);
+    }
+    return c->pwcs[level];
+}
+
+// of the running core
+tlb_t *mmu_tlb(mmu_tlb_level_t level, page_size_t page_size)
+{
+    assert(level >= 0 && level < NUM_MMU_TLBS);
+    assert(page_size >= 0 && page_size < NUM_PAGE_SIZES);
+    return core_tlb(core_of(running_core), level, page_size);
+}
+
+void mmu_tlb_configure(mmu_tlb_level_t level, page_size_t page_size, int index_length, int num_ways, uint64_t latency)
+{
+    assert(level >= 0 && level < NUM_MMU_TLBS);
+    assert(page_size >= 0 && page_size < NUM_PAGE_SIZES);
+    tlb_geometries[level][page_size][0] = index_length;
+    tlb_geometries[level][page_size][1] = num_ways;
+    tlb_latencies[level] = latency;
+    for(int i = 0; i < MMU_MAX_CORES; i ++ )
+    {
+        if(cores[i] != NULL)
+        {
+            tlb_free(cores[i]->tlbs[level][page_size]);
+            cores[i]->tlbs[level][page_size] = NULL;
+        }
+    }
+}
+
+void mmu_set_walk_latency(uint64_t latency)
+{
+    walk_step_latency = latency;
+}
+
+tlb_t *mmu_pwc(mmu_pwc_level_t level)
+{
+    assert(level >= 0 && level < NUM_MMU_PWCS);
+    return core_pwc(core_of(running_core), level);
+}
+
+void mmu_pwc_configure(mmu_pwc_level_t level, int index_length, int num_ways)
+{
+    assert(level >= 0 && level < NUM_MMU_PWCS);
+    pwc_geometries[level][0] = index_length;
+    pwc_geometries[level][1] = num_ways;
+    for(int i = 0; i < MMU_MAX_CORES; i ++ )
+    {
+        if(cores[i] != NULL)
+        {
+            tlb_free(cores[i]->pwcs[level]);
+            cores[i]->pwcs[level] = NULL;
+        }
+    }
+}
+
+static inline int pwc_lookup(mmu_pwc_level_t level, uint64_t vaddr, uint64_t *table)
+{
+    return tlb_lookup(mmu_pwc(level), vaddr >> pwc_shifts[level], table);
+}
+
+static inline void pwc_insert(mmu_pwc_level_t level, uint64_t vaddr, void *table)
+{
+    tlb_insert(mmu_pwc(level), vaddr >> pwc_shifts[level], (uint64_t)table);
+}
+
+static void core_set_asid(mmu_core_t *c, int asid)
+{
+    c->current_asid = asid;
+    for(int i = 0; i < NUM_MMU_TLBS; i ++ )
+    {
+        for(int j = 0; j < NUM_PAGE_SIZES; j ++ )
+        {
+            tlb_set_asid(core_tlb(c, i, j), asid);
+        }
+    }
+    for(int i = 0; i < NUM_MMU_PWCS; i ++ )
+    {
+        tlb_set_asid(core_pwc(c, i), asid);
+    }
+}
+
+static void core_flush(mmu_core_t *c)
+{
+    for(int i = 0; i < NUM_MMU_TLBS; i ++ )
+    {
+        for(int j = 0; j < NUM_PAGE_SIZES; j ++ )
+        {
+            tlb_flush(core_tlb(c, i, j));
+        }
+    }
+    for(int i = 0; i < NUM_MMU_PWCS; i ++ )
+    {
+        tlb_flush(core_pwc(c, i));
+    }
+}
+
+static void core_flush_asid(mmu_core_t *c, int asid)
+{
+    for(int i = 0; i < NUM_MMU_TLBS; i ++ )
+    {
+        for(int j = 0; j < NUM_PAGE_SIZES; j ++ )
+        {
+            tlb_flush_asid(core_tlb(c, i, j), asid);
+        }
+    }
+    for(int i = 0; i < NUM_MMU_PWCS; i ++ )
+    {
+        tlb_flush_asid(core_pwc(c, i), asid);
+    }
+    mmu_stats.asid_flush_count ++ ;
+}
+
+// the translations of the page in all the address spaces, and with paging_structures, the
+// paging structure entries used to translate it too
+static void core_invalidate_page(mmu_core_t *c, uint64_t vaddr, int paging_structures)
+{
+    uint64_t vpn = vaddr >> VIRTUAL_PAGE_OFFSET_LENGTH;
+    for(int i = 0; i < NUM_MMU_TLBS; i ++ )
+    {
+        for(int j = 0; j < NUM_PAGE_SIZES; j ++ )
+        {
+            tlb_invalidate_all_asids(core_tlb(c, i, j), vpn >> page_size_shifts[j]);
+        }
+    }
+    for(int i = 0; paging_structures == 1 && i < NUM_MMU_PWCS; i ++ )
+    {
+        tlb_invalidate_all_asids(core_pwc(c, i), vaddr >> pwc_shifts[i]);
+    }
+}
+
+/* ++++++++++++++ software translation cache +++++++++++ */
+// functional simulation, without the modelled TLB: a direct mapped cache vpn -> the page in pm
+// on the host. it is not part of the simulated machine, it saves the page walk of every access,
+// and va_read64/va_write64 load and store through it. it is flushed with the TLBs: CR3 writes,
+// INVLPG (page table changes and evictions), and when pm moves
+#define SOFT_TLB_INDEX_LENGTH   (10)
+#define NUM_SOFT_TLB_ENTRIES    (1 << SOFT_TLB_INDEX_LENGTH)
+
+typedef struct
+{
+    uint64_t vpn;
+    uint8_t *page;
+} soft_tlb_entry_t;
+
+static soft_tlb_entry_t soft_tlb[NUM_SOFT_TLB_ENTRIES];
+static uint8_t *soft_tlb_pm = NULL;     // the pm the pages point into, NULL to flush
+
+static void soft_tlb_flush()
+{
+    for(int i = 0; i < NUM_SOFT_TLB_ENTRIES; i ++ )
+    {
+        soft_tlb[i].vpn = TLB_VPN_INVALID;
+    }
+    soft_tlb_pm = pm;
+}
+
+static inline uint8_t *soft_tlb_translate(uint64_t vaddr)
+{
+    if(soft_tlb_pm != pm)
+    {
+        soft_tlb_flush();
+    }
+
+    uint64_t vpn = vaddr >> VIRTUAL_PAGE_OFFSET_LENGTH;
+    soft_tlb_entry_t *e = &soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)];
+    if(e->vpn != vpn)
+    {
+        page_size_t page_size;
+        mmu_stats.walk_count ++ ;
+        uint64_t paddr = page_walk(vaddr & ~((uint64_t)PHYSICAL_PAGE_SIZE - 1), &page_size);
+        e->vpn = vpn;
+        e->page = pm + paddr;
+    }
+    return e->page + (vaddr & (PHYSICAL_PAGE_SIZE - 1));
+}
+/* ----------------- software translation cache ----------------- */
+
+/* ++++++++++++++ address space IDs +++++++++++ */
+// the entries of the TLBs and the page walk caches are tagged with the ASID (PCID) of their
+// address space. each core gives its ASIDs to the CR3 values like Linux gives its few dynamic
+// ASIDs of a cpu to the mm: a CR3 write to an address space which still has its ASID keeps
+// its entries, otherwise the least recently used ASID is taken over and flushed.
+// with 0 ASIDs, every CR3 write flushes the TLBs
+static int num_asids = 6;
+
+void mmu_flush_asid(int asid)
+{
+    assert(asid >= 0 && asid < MAX_ASIDS);
+    soft_tlb_pm = NULL;
+    core_flush_asid(core_of(running_core), asid);
+}
+
+int mmu_current_asid()
+{
+    return core_of(running_core)->current_asid;
+}
+
+void mmu_set_num_asids(int n)
+{
+    assert(n >= 0 && n <= MAX_ASIDS);
+    num_asids = n;
+    for(int i = 0; i < num_cores; i ++ )
+    {
+        mmu_core_t *c = core_of(i);
+        memset(c->asid_cr3s, 0, sizeof(c->asid_cr3s));
+        memset(c->asid_times, 0, sizeof(c->asid_times));
+        core_set_asid(c, 0);
+        core_flush(c);
+    }
+}
+
+void mmu_write_cr3(uint64_t cr3)
+{
+    soft_tlb_pm = NULL;
+
+    mmu_core_t *c = core_of(running_core);
+    uint64_t old_cr3 = cpu_controls.cr3;
+    cpu_controls.cr3 = cr3;
+    mmu_stats.cr3_write_count ++ ;
+
+    if(num_asids == 0)
+    {
+        core_flush(c);
+        mmu_stats.flush_count ++ ;
+        return;
+    }
+
+    c->asid_clock ++ ;
+    int asid = -1;
+    if(cr3 != 0)
+    {
+        // CR3 0 is a new address space, never found
+        for(int i = 0; i < num_asids; i ++ )
+        {
+            if(c->asid_times[i] != 0 && c->asid_cr3s[i] == cr3)
+            {
+                asid = i;
+                if(cr3 != old_cr3)
+                {
+                    // a switch back to the address space, not a write of the same CR3
+                    mmu_stats.flush_avoided_count ++ ;
+                }
+                break;
+            }
+        }
+    }
+
+    if(asid < 0)
+    {
+        // a free ASID if any, otherwise the LRU one, whose entries go
+        asid = 0;
+        for(int i = 1; i < num_asids; i ++ )
+        {
+            asid = c->asid_times[i] < c->asid_times[asid] ? i : asid;
+        }
+        if(c->asid_times[asid] != 0)
+        {
+            core_flush_asid(c, asid);
+        }
+    }
+
+    // nothing is cached under CR3 0 before the page walk makes its pgd and writes CR3 again:
+    // the ASID stays free, and the pgd takes it (or another free one) without a flush
+    c->asid_cr3s[asid] = cr3;
+    c->asid_times[asid] = cr3 != 0 ? c->asid_clock : 0;
+    core_set_asid(c, asid);
+}
+/* ----------------- address space IDs ----------------- */
+
+/* ++++++++++++++ TLB shootdown +++++++++++ */
+// a page reclaimed or an address space freed may still be in the TLBs of the other cores.
+// page_map keeps the cores which filled the translation of each 4KB page (its cpumask), and
+// only they get an IPI to invalidate it. the running core invalidates at once, without IPI.
+// the invalidations are batched like Linux batches them in reclaim: queued, then sent together,
+// one IPI per core, when the batch is full, at the end of the page fault, before a dirty page
+// is written to swap, and before another core runs. a core with more pages than the ceiling
+// flushes its whole TLB instead (tlb_single_page_flush_ceiling of Linux).
+// the initiator waits for the slowest core to acknowledge, the others lose their interrupt
+typedef struct
+{
+    uint64_t vaddr;
+    uint64_t cpumask;
+    int asid;           // -1 for the page at vaddr, else flush this ASID of the core of cpumask
+} shootdown_t;
+
+static shootdown_t *shootdowns = NULL;
+static int num_shootdowns = 0;
+static int max_shootdowns = 0;
+
+static int shootdown_batch = 32;        // SWAP_CLUSTER_MAX, 1 sends each at once
+static int shootdown_ceiling = 33;
+static uint64_t ipi_latency = 2000;     // send, interrupt and acknowledge
+static uint64_t invlpg_latency = 100;
+static uint64_t tlb_flush_latency = 500;
+
+mmu_shootdown_stats_t mmu_shootdown_stats;
+
+void mmu_set_shootdown_batch(int max_requests)
+{
+    assert(max_requests > 0);
+    mmu_shootdown_flush();
+    shootdown_batch = max_requests;
+}
+
+void mmu_set_shootdown_ceiling(int max_pages)
+{
+    assert(max_pages >= 0);
+    shootdown_ceiling = max_pages;
+}
+
+void mmu_set_shootdown_latency(uint64_t ipi, uint64_t invlpg, uint64_t flush)
+{
+    ipi_latency = ipi;
+    invlpg_latency = invlpg;
+    tlb_flush_latency = flush;
+}
+
+void mmu_shootdown_flush()
+{
+    if(num_shootdowns == 0)
+    {
+        return;
+    }
+
+    uint64_t targets = 0;
+    for(int i = 0; i < num_shootdowns; i ++ )
+    {
+        targets |= shootdowns[i].cpumask;
+    }
+
+    uint64_t slowest = 0;
+    for(int id = 0; id < num_cores; id ++ )
+    {
+        if(((targets >> id) & 1) == 0)
+        {
+            continue;
+        }
+
+        mmu_core_t *c = core_of(id);
+        int num_pages = 0;
+        for(int i = 0; i < num_shootdowns; i ++ )
+        {
+            num_pages += ((shootdowns[i].cpumask >> id) & 1) == 1 && shootdowns[i].asid < 0;
+        }
+
+        uint64_t cycles = ipi_latency;
+        if(num_pages > shootdown_ceiling)
+        {
+            core_flush(c);
+            cycles += tlb_flush_latency;
+            mmu_shootdown_stats.flush_count ++ ;
+        }
+        else
+        {
+            for(int i = 0; i < num_shootdowns; i ++ )
+            {
+                shootdown_t *r = &shootdowns[i];
+                if(((r->cpumask >> id) & 1) == 0)
+                {
+                    continue;
+                }
+                if(r->asid < 0)
+                {
+                    core_invalidate_page(c, r->vaddr, 1);
+                    cycles += invlpg_latency;
+                    mmu_shootdown_stats.invalidate_count ++ ;
+                }
+                else
+                {
+                    core_flush_asid(c, r->asid);
+                    cycles += tlb_flush_latency;
+                }
+            }
+        }
+
+        mmu_shootdown_stats.ipi_count ++ ;
+        mmu_shootdown_stats.target_cycles += cycles;
+        slowest = cycles > slowest ? cycles : slowest;
+    }
+
+    mmu_shootdown_stats.batch_count ++ ;
+    mmu_shootdown_stats.initiator_cycles += slowest;
+    num_shootdowns = 0;
+}
+
+static void shootdown_queue(uint64_t vaddr, uint64_t cpumask, int asid)
+{
+    mmu_shootdown_stats.request_count ++ ;
+    if(cpumask == 0)
+    {
+        mmu_shootdown_stats.local_count ++ ;
+        return;
+    }
+
+    if(num_shootdowns == max_shootdowns)
+    {
+        max_shootdowns = max_shootdowns > 0 ? max_shootdowns * 2 : 64;
+        shootdowns = realloc(shootdowns, max_shootdowns * sizeof(shootdown_t));
+        assert(shootdowns != NULL);
+    }
+    shootdowns[num_shootdowns].vaddr = vaddr;
+    shootdowns[num_shootdowns].cpumask = cpumask;
+    shootdowns[num_shootdowns].asid = asid;
+    num_shootdowns ++ ;
+
+    if(num_shootdowns >= shootdown_batch)
+    {
+        mmu_shootdown_flush();
+    }
+}
+
+// the translations of the page of ppn at vaddr, in all the address spaces and on all the cores
+// which may have them: the page is unmapped
+static void shootdown_page(uint64_t ppn, uint64_t vaddr)
+{
+    uint64_t vpn = vaddr >> VIRTUAL_PAGE_OFFSET_LENGTH;
+    if(soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)].vpn == vpn)
+    {
+        soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)].vpn = TLB_VPN_INVALID;
+    }
+    core_invalidate_page(core_of(running_core), vaddr, 1);
+    mmu_shootdown_stats.initiator_cycles += invlpg_latency;
+
+    uint64_t cpumask = page_map[ppn].cpumask & ~((uint64_t)1 << running_core);
+    page_map[ppn].cpumask = 0;
+    shootdown_queue(vaddr, cpumask, -1);
+}
+/* ----------------- TLB shootdown ----------------- */
+
+void mmu_set_num_cores(int n)
+{
+    assert(n > 0 && n <= MMU_MAX_CORES);
+    mmu_shootdown_flush();
+    num_cores = n;
+    if(running_core >= n)
+    {
+        mmu_switch_core(0);
+    }
+}
+
+void mmu_switch_core(int id)
+{
+    assert(id >= 0 && id < num_cores);
+    // the invalidations for the core must be done before it runs
+    mmu_shootdown_flush();
+
+    soft_tlb_pm = NULL;
+    core_of(running_core)->cr3 = cpu_controls.cr3;
+    running_core = id;
+    cpu_controls.cr3 = core_of(id)->cr3;
+}
+
+int mmu_current_core()
+{
+    return running_core;
+}
+
+// the translations of the page on the running core, in all the address spaces, not the paging
+// structure entries. the other cores keep theirs: clearing the accessed bit needs no
+// shootdown (as on x86 Linux), their accesses are not seen until their entries go
+static void invalidate_tlbs(uint64_t vpn)
+{
+    if(soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)].vpn == vpn)
+    {
+        soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)].vpn = TLB_VPN_INVALID;
+    }
+    core_invalidate_page(core_of(running_core), vpn << VIRTUAL_PAGE_OFFSET_LENGTH, 0);
+}
+
+// INVLPG: vaddr in the current address space of the running core, also the paging structure
+// entries used to translate it
+void mmu_invalidate_page(uint64_t vaddr)
+{
+    uint64_t vpn = vaddr >> VIRTUAL_PAGE_OFFSET_LENGTH;
+    if(soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)].vpn == vpn)
+    {
+        soft_tlb[vpn & (NUM_SOFT_TLB_ENTRIES - 1)].vpn = TLB_VPN_INVALID;
+    }
+    for(int i = 0; i < NUM_MMU_TLBS; i ++ )
+    {
+        for(int j = 0; j < NUM_PAGE_SIZES; j ++ )
+        {
+            tlb_invalidate(mmu_tlb(i, j), vpn >> page_size_shifts[j]);
+        }
+    }
+    for(int i = 0; i < NUM_MMU_PWCS; i ++ )
+    {
+        tlb_invalidate(mmu_pwc(i), vaddr >> pwc_shifts[i]);
+    }
+}
+
+// the pages mapped by the tables of the arena go back to the free lists, the 4KB pages and
+// the pages of the huge pages, unpinned. the cores drop the ASIDs of the address space: the
+// running core flushes them, the others get them in the shootdown
+void mmu_free_address_space(page_table_arena_t *a)
+{
+    for(uint64_t i = 0; i < pm_num_pages; i ++ )
+    {
+        pd_t *pd = &page_map[i];
+        if(pd->allocated == 0)
+        {
+            continue;
+        }
+        if(pd->huge == 1 && page_table_arena_of(pd->huge_pte) == a)
+        {
+            pd->huge = 0;
+            pd->huge_pte = NULL;
+            page_release(i);
+            pd->cpumask = 0;
+        }
+        else if(pd->huge == 0 && pd->pte4 != NULL && page_table_arena_of(pd->pte4) == a)
+        {
+            page_release(i);
+            pd->cpumask = 0;
+        }
+    }
+
+    for(int id = 0; id < num_cores; id ++ )
+    {
+        mmu_core_t *c = core_of(id);
+        for(int i = 0; i < num_asids; i ++ )
+        {
+            if(c->asid_times[i] == 0 || c->asid_cr3s[i] == 0 || page_table_arena_contains(a, (void *)c->asid_cr3s[i]) == 0)
+            {
+                continue;
+            }
+            c->asid_times[i] = 0;
+            if(id == running_core)
+            {
+                core_flush_asid(c, i);
+            }
+            else
+            {
+                shootdown_queue(0, (uint64_t)1 << id, i);
+            }
+        }
+    }
+    mmu_shootdown_flush();
+
+    if(a == page_table_arena_current())
+    {
+        mmu_write_cr3(0);
+    }
+    page_table_arena_free(a);
+}
+
+// the pages of all sizes are looked up, the misses of a size count the lookups which did not
+// find the page among the entries of this size
+static int tlb_hit(mmu_tlb_level_t level, uint64_t vaddr, uint64_t *paddr, page_size_t *page_size)
+{
+    uint64_t vpn = vaddr >> VIRTUAL_PAGE_OFFSET_LENGTH;
     uint64_t ppn;
-} tlb_cacheline_t;
 
-typedef struct // cache 组
+    mmu_stats.lookup_counts[level] ++ ;
+    for(int i = 0; i < NUM_PAGE_SIZES; i ++ )
+    {
+        if(tlb_lookup(mmu_tlb(level, i), vpn >> page_size_shifts[i], &ppn) == 1)
+        {
+            ppn |= vpn & ((1 << page_size_shifts[i]) - 1);
+            *paddr = (ppn << PHYSICAL_PAGE_OFFSET_LENGTH) | (vaddr & ((1 << VIRTUAL_PAGE_OFFSET_LENGTH) - 1));
+            *page_size = i;
+            mmu_stats.hit_counts[level] ++ ;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// the core may cache the translation of the page from now on (the huge pages are never unmapped)
+static void tlb_fill(mmu_tlb_level_t level, uint64_t vaddr, uint64_t paddr, page_size_t page_size)
 {
-    tlb_cacheline_t lines[NUM_TLB_CACHE_LINE_PRE_SET];
-} tlb_cacheset_t;
+    int shift = page_size_shifts[page_size];
+    if(page_size == PAGE_4K)
+    {
+        page_map[paddr >> PHYSICAL_PAGE_OFFSET_LENGTH].cpumask |= (uint64_t)1 << running_core;
+    }
+    tlb_insert(mmu_tlb(level, page_size),
+        vaddr >> (VIRTUAL_PAGE_OFFSET_LENGTH + shift),
+        (paddr >> (PHYSICAL_PAGE_OFFSET_LENGTH + shift)) << shift);
+}
 
-typedef struct // cache
+#if USE_TLB_HARDWARE
+static uint64_t translate(mmu_tlb_level_t level, uint64_t vaddr)
 {
-    tlb_cacheset_t sets[(1 << TLB_CACHE_INDEX_LENGTH)];
-} tlb_cache_t;
+    uint64_t paddr = 0;
+    page_size_t page_size;
+    mmu_stats.translation_count ++ ;
 
-static tlb_cache_t mmu_tlb;
-/* ----------------- TLB CACHE ----------------- */
+    mmu_stats.cycles += tlb_latencies[level];
+    if(tlb_hit(level, vaddr, &paddr, &page_size) == 1)
+    {
+        // L1 TLB hit
+        return paddr;
+    }
 
+    mmu_stats.cycles += tlb_latencies[MMU_STLB];
+    if(tlb_hit(MMU_STLB, vaddr, &paddr, &page_size) == 1)
+    {
+        // STLB hit: refill the L1 TLB
+        tlb_fill(level, vaddr, paddr, page_size);
+        return paddr;
+    }
 
-static uint64_t page_walk(uint64_t vaddr_value);
-static void page_fault_handler(pte4_t *pet, address_t vaddr); 
+    // TLB read miss
+    // assume that page_walk is consuming much time: it counts its cycles itself
+    mmu_stats.walk_count ++ ;
+    paddr = page_walk(vaddr, &page_size);
 
-int swap_in(uint64_t daddr, uint64_t ppn);
-int swap_out(uint64_t daddr, uint64_t ppn);
+    // refresh TLB, page_walk always returns a present page
+    tlb_fill(MMU_STLB, vaddr, paddr, page_size);
+    tlb_fill(level, vaddr, paddr, page_size);
+
+    return paddr;
+}
+#else
+// functional: no TLB is modelled, the software translation cache walks the pages it misses
+static uint64_t translate(mmu_tlb_level_t level, uint64_t vaddr)
+{
+    mmu_stats.translation_count ++ ;
+    return soft_tlb_translate(vaddr) - pm;
+}
+#endif
+
+uint64_t va2pa(uint64_t vaddr)
+{
+    return translate(MMU_DTLB, vaddr);
+}
+
+uint64_t va2pa_inst(uint64_t vaddr)
+{
+    return translate(MMU_ITLB, vaddr);
+}
+
+void mmu_print(FILE *fw)
+{
+    static const char *level_names[NUM_MMU_TLBS] = {
+        [MMU_ITLB] = "itlb",
+        [MMU_DTLB] = "dtlb",
+        [MMU_STLB] = "stlb",
+    };
+    static const char *size_names[NUM_PAGE_SIZES] = {
+        [PAGE_4K] = "4k",
+        [PAGE_2M] = "2m",
+        [PAGE_1G] = "1g",
+    };
+
+    for(int i = 0; i < NUM_MMU_TLBS; i ++ )
+    {
+        uint64_t lookups = mmu_stats.lookup_counts[i];
+        fprintf(fw, "%s lookups:%lu hits:%lu hit ratio:%.4f\n", level_names[i], lookups, mmu_stats.hit_counts[i],
+            lookups > 0 ? (double)mmu_stats.hit_counts[i] / lookups : 0.0);
+        for(int j = 0; j < NUM_PAGE_SIZES; j ++ )
+        {
+            char name[16];
+            sprintf(name, "  %s %s", level_names[i], size_names[j]);
+            tlb_print(mmu_tlb(i, j), name, fw);
+        }
+    }
+    tlb_print(mmu_pwc(MMU_PWC_PML4), "pwc pml4", fw);
+    tlb_print(mmu_pwc(MMU_PWC_PDPT), "pwc pdpt", fw);
+    tlb_print(mmu_pwc(MMU_PWC_PDE), "pwc pde", fw);
+    fprintf(fw, "translations:%lu page walks:%lu walk steps:%lu saved:%lu cycles:%lu (%.2f per translation)\n",
+        mmu_stats.translation_count, mmu_stats.walk_count,
+        mmu_stats.walk_step_count, mmu_stats.walk_step_saved_count, mmu_stats.cycles,
+        mmu_stats.translation_count > 0 ? (double)mmu_stats.cycles / mmu_stats.translation_count : 0.0);
+    fprintf(fw, "page faults:%lu zero:%lu major:%lu minor:%lu swap ins:%lu outs:%lu readahead:%lu hits:%lu misses:%lu fault-around:%lu\n",
+        page_fault_stats.fault_count, page_fault_stats.zero_fill_count,
+        page_fault_stats.major_count, page_fault_stats.minor_count,
+        page_fault_stats.swap_in_count, page_fault_stats.swap_out_count,
+        page_fault_stats.readahead_count, page_fault_stats.readahead_hit_count,
+        page_fault_stats.readahead_miss_count, page_fault_stats.fault_around_count);
+    fprintf(fw, "cr3 writes:%lu asids:%d flushes:%lu avoided:%lu asid flushes:%lu\n",
+        mmu_stats.cr3_write_count, num_asids, mmu_stats.flush_count,
+        mmu_stats.flush_avoided_count, mmu_stats.asid_flush_count);
+    fprintf(fw, "shootdowns cores:%d requests:%lu local:%lu batches:%lu ipis:%lu invalidations:%lu flushes:%lu cycles initiator:%lu targets:%lu\n",
+        num_cores, mmu_shootdown_stats.request_count, mmu_shootdown_stats.local_count,
+        mmu_shootdown_stats.batch_count, mmu_shootdown_stats.ipi_count,
+        mmu_shootdown_stats.invalidate_count, mmu_shootdown_stats.flush_count,
+        mmu_shootdown_stats.initiator_cycles, mmu_shootdown_stats.target_cycles);
+    page_table_print(fw);
+}
+/* ----------------- TLB hierarchy ----------------- */
+
+/* bulk transfer at virtual addresses: va2pa once per page, then copy page by page,
+    since contiguous virtual pages need not be contiguous physically
+*/
+// bytes from vaddr to the end of its page, at most size
+static inline uint64_t page_chunk(uint64_t vaddr, uint64_t size)
+{
+    uint64_t left = PHYSICAL_PAGE_SIZE - (vaddr & (PHYSICAL_PAGE_SIZE - 1));
+    return left < size ? left : size;
+}
+
+// a store makes the page dirty: the page reclaim writes it back to swap before reusing it
+static inline uint64_t set_dirty(uint64_t paddr)
+{
+    pd_t *pd = &page_map[paddr >> PHYSICAL_PAGE_OFFSET_LENGTH];
+    if(pd->pte4 != NULL)
+    {
+        pd->dirty = 1;
+        pd->pte4->dirty = 1;
+    }
+    return paddr;
+}
+
+void va_copy_to(uint64_t vaddr, const void *src, uint64_t size)
+{
+    const uint8_t *s = src;
+    while(size > 0)
+    {
+        uint64_t n = page_chunk(vaddr, size);
+        dram_copy_to(set_dirty(va2pa(vaddr)), s, n);
+        vaddr += n;
+        s += n;
+        size -= n;
+    }
+}
+
+void va_copy_from(void *dst, uint64_t vaddr, uint64_t size)
+{
+    uint8_t *d = dst;
+    while(size > 0)
+    {
+        uint64_t n = page_chunk(vaddr, size);
+        dram_copy_from(d, va2pa(vaddr), n);
+        vaddr += n;
+        d += n;
+        size -= n;
+    }
+}
+
+/* the loads and stores of the instructions: with the TLBs modelled through va2pa, in functional
+    simulation (USE_TLB_HARDWARE 0) through the software translation cache. the data goes through
+    the SRAM cache when it is enabled, otherwise straight to the host memory. little-endian, like dram.c
+*/
+uint64_t va_read64(uint64_t vaddr)
+{
+#if USE_TLB_HARDWARE
+    return cpu_read64bits_dram(va2pa(vaddr));
+#else
+    mmu_stats.translation_count ++ ;
+    uint8_t *p = soft_tlb_translate(vaddr);
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    return cpu_read64bits_dram(p - pm);
+#else
+    if(memory_profile_enabled != 0)
+    {
+        memory_profile_access(p - pm, 0);
+    }
+    uint64_t val = 0x0;
+    for(int i = 0; i < sizeof(uint64_t); i ++ )
+    {
+        val |= (uint64_t)p[i] << (i * 8);
+    }
+    return val;
+#endif
+#endif
+}
 
-static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index);
-static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_line_index);
+void va_write64(uint64_t vaddr, uint64_t data)
+{
+#if USE_TLB_HARDWARE
+    cpu_write64bits_dram(set_dirty(va2pa(vaddr)), data);
+#else
+    mmu_stats.translation_count ++ ;
+    uint8_t *p = soft_tlb_translate(vaddr);
+    set_dirty(p - pm);
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    cpu_write64bits_dram(p - pm, data);
+#else
+    if(memory_profile_enabled != 0)
+    {
+        memory_profile_access(p - pm, 1);
+    }
+    for(int i = 0; i < sizeof(uint64_t); i ++ )
+    {
+        p[i] = (data >> (i * 8)) & 0xff;
+    }
+#endif
+#endif
+}
 
+void va_set(uint64_t vaddr, uint8_t value, uint64_t size)
+{
+    while(size > 0)
+    {
+        uint64_t n = page_chunk(vaddr, size);
+        dram_set(set_dirty(va2pa(vaddr)), value, n);
+        vaddr += n;
+        size -= n;
+    }
+}
 
+/* ++++++++++++++ huge pages +++++++++++ */
+#define MAX_HUGE_REGIONS (16)
 
-uint64_t va2pa(uint64_t vaddr)
+typedef struct
 {
-    uint64_t paddr = 0;
+    uint64_t start;
+    uint64_t end;
+    page_size_t page_size;
+} huge_region_t;
 
-#ifdef USE_TLB_HADRDWARE   
-    int free_tlb_line_index = -1;
-    int tlb_hit = read_tlb(vaddr, &paddr, &free_tlb_line_index);
+static huge_region_t huge_regions[MAX_HUGE_REGIONS];
+static int num_huge_regions = 0;
 
-    // TODO: add flag to read this failed
-    if(tlb_hit == 1)
+void mmu_request_huge_pages(uint64_t vaddr, uint64_t size, page_size_t page_size)
+{
+    assert(page_size == PAGE_2M || page_size == PAGE_1G);
+    if(num_huge_regions == MAX_HUGE_REGIONS)
     {
-        // TLB read hit
-        return paddr;
+        printf("mmu: at most %d huge page regions\n", MAX_HUGE_REGIONS);
+        exit(0);
     }
+    huge_regions[num_huge_regions ++ ] = (huge_region_t){
+        .start = vaddr,
+        .end = vaddr + size,
+        .page_size = page_size,
+    };
+}
 
-    // TLB read miss
-#endif
-
-    // assume that page_walk is consuming much time
-    paddr = page_walk(vaddr);
-
-#ifdef USE_TLB_HARDWARE
-    // refresh TLB
-    // TODO: check if this paddr from page table is a legal address
-    if(paddr != 0)
+// the huge page of page_size around vaddr lies in a region asking for pages this large at least
+static int huge_region(uint64_t vaddr, page_size_t page_size)
+{
+    uint64_t bytes = (uint64_t)PHYSICAL_PAGE_SIZE << page_size_shifts[page_size];
+    uint64_t start = vaddr & ~(bytes - 1);
+    for(int i = 0; i < num_huge_regions; i ++ )
     {
-        // TLB write
-        if(write_tlb(vaddr, paddr, free-tlb_line_index) == 1)
+        huge_region_t *r = &huge_regions[i];
+        if(r->page_size >= page_size && r->start <= start && start + bytes <= r->end)
         {
-            return paddr;
+            return 1;
         }
     }
-#endif 
-
-    // use page table as va2pa
-    return paddr;
+    return 0;
 }
 
-static int read_tlb(uint64_t vaddr_value, uint64_t *paddr_value_ptr, int *free_tlb_line_index)
+/* the pud or pmd entry of vaddr is missing in a huge page region: map a huge page, made of
+    contiguous free physical pages aligned on its size, from the nodes of the NUMA policy.
+    without such pages, the entry gets a table of the next level instead and the page is
+    mapped by smaller pages
+*/
+static void huge_page_fault(pte123_t *pte, address_t vaddr, page_size_t page_size)
 {
-    address_t addr = {
-        .address_value = vaddr_value,
-    };
+    assert(pte->present == 0);
+    uint64_t num_pages = (uint64_t)1 << page_size_shifts[page_size];
+    uint64_t vpn = (vaddr.vaddr_value >> VIRTUAL_PAGE_OFFSET_LENGTH) & ~(num_pages - 1);
 
-    tlb_cacheset_t *set = &mmu_tlb.sets[addr.tlbi];
-    *free_tlb_line_index = -1;
-    
-    for(int i = 0; i < NUM_TLB_CACHE_LINE_PRE_SET; i ++ )
+    int nodes[NUMA_MAX_NODES];
+    int num_nodes = numa_fault_nodes(vaddr.vaddr_value, nodes);
+    for(int k = 0; k < num_nodes; k ++ )
     {
-        tlb_cacheline_t *line = &set->lines[i];
-        
-        if(line->valid == 0)
+        uint64_t first = numa_num_nodes > 1 ? numa_nodes[nodes[k]].first_page : 0;
+        uint64_t last = numa_num_nodes > 1 ? first + numa_nodes[nodes[k]].num_pages : pm_num_pages;
+        first = (first + num_pages - 1) & ~(num_pages - 1);
+        for(uint64_t base = first; base + num_pages <= last; base += num_pages)
         {
-            *free_tlb_line_index = i;
-        }
-        
-        if(line->tag == addr.tlbt && line->valid != 0)
-        {
-            // TLB read hit
-            *paddr_value_ptr = line->ppn;
-            return 1;
+            uint64_t i = 0;
+            while(i < num_pages && page_is_free(base + i) == 1)
+            {
+                i ++ ;
+            }
+            if(i < num_pages)
+            {
+                continue;
+            }
+
+            debug_print(DEBUG_MMU, "PageFault: use free ppn %lu - %lu as huge page\n", base, base + num_pages - 1);
+            for(i = 0; i < num_pages; i ++ )
+            {
+                pd_t *pd = &page_map[base + i];
+                page_take(base + i);
+                pd->allocated = 1;
+                pd->dirty = 0;
+                pd->huge = 1;
+                pd->huge_pte = pte;
+                pd->pte4 = NULL;
+                pd->vpn = vpn + i;
+                numa_page_allocated(base + i);
+            }
+            // like the 4KB pages never swapped out: no bytes of a former owner
+            dram_set(base << PHYSICAL_PAGE_OFFSET_LENGTH, 0, num_pages << PHYSICAL_PAGE_OFFSET_LENGTH);
+
+            pte->pte_value = 0;
+            pte->present = 1;
+            pte->pagesize = 1;
+            pte->paddr = base;
+            return;
         }
     }
 
-    // TLB read miss
-    paddr_value_ptr = NULL;
-    return 0;
-}
-
-static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_line_index)
-{
-    address_t vaddr = {
-        .address_value = vaddr_value,
-    };
-    address_t paddr = {
-        .address_value = paddr_value,
-    };
-    tlb_cacheset_t *set = &mmu_tlb.sets[vaddr.tlbi];
-    
-    // get a valid tlb index
-    if(free_tlb_line_index >= 0 && free_tlb_line_index < NUM_TLB_CACHE_LINE_PRE_SET)
-    {
-        tlb_cacheline_t *line = &set->lines[free_tlb_line_index];
-
-        line->valid = 1;
-        line->ppn = paddr.ppn;
-        line->tag = vaddr.tlbt;
-        
-        return 1;
-    }
-
-    // no free TLB cache line, select RANDOM victim but LRU
-    // because it's very fast
-    srand(time(NULL));
-    int random_victim_index = rand() % NUM_TLB_CACHE_LINE_PRE_SET;
-    tlb_cacheline_t *line = &set->lines[random_victim_index];
-
-    line->valid = 1;
-    line->ppn = paddr.ppn;
-    line->tag = vaddr.tlbt;
-        
-    return 1;
+    // fall back to the smaller pages
+    debug_print(DEBUG_MMU, "PageFault: no %lu contiguous free pages for a huge page, use smaller pages\n", num_pages);
+    pte->pte_value = 0;
+    pte->present = 1;
+    pte->paddr = (uint64_t)page_table_alloc(page_size == PAGE_1G ? PAGE_TABLE_PMD : PAGE_TABLE_PT);
 }
+/* ----------------- huge pages ----------------- */
 
 // input - virtual address
 // output - physical address
@@ -156,133 +1028,294 @@ static int write_tlb(uint64_t vaddr_value, uint64_t paddr_value, int free_tlb_li
 这样cr3原本是指向一个pa的，现在指向了heap中的一个地址
 作者说：这是一个妥协，只是为了方便coding
 */
-static uint64_t page_walk(uint64_t vaddr_value)
+static uint64_t page_walk(uint64_t vaddr_value, page_size_t *page_size)
 {
     // 转换地址类型，方便我们直接得到ppn，ppo等，而不是各种位运算（当然直接使用位运算是可行的，但是太麻烦且不好拓展）
     address_t vaddr = {
         .vaddr_value = vaddr_value,
     };
     // CR3-> PGD -> PUD -> PMD -> PT -> PPN
-    int page_table_size = PAGE_TABLE_ENTRY_NUM * sizeof(pte123_t);
-    
-    // CR3 register's value is malloced on the heap of this simulator
-    pte123_t *pgd = (pte123_t *)((uint64_t)cpu_controls.cr3);           // page global directory
-    assert(pgd != NULL); // 肯定存在
-    
-    if (pgd[vaddr.vpn1].present == 1) // vaddr.vpn1 is the offset of the page table - pgd's starting address
+    // a missing level is a new table from the pool (pgtable.c), and the walk goes on
+
+    // the page walk cache gives the deepest table it knows, the walk starts there
+    pte123_t *pud = NULL;
+    pte123_t *pmd = NULL;
+    pte4_t *pt = NULL;
+    uint64_t table;
+    if(pwc_lookup(MMU_PWC_PDE, vaddr_value, &table) == 1)
     {
-        // starting PHYSICAL PAGE NUMBER of the next level page table
-        // aka. high bits starting address of the page table
-        // aka. (also known as，亦称、也被称为) 
-        // 下一级页表的起始地址，同时我们也认为它是下一级页表的页号
-        pte123_t *pud =(pte123_t *)((uint64_t)pgd[vaddr.vpn1].paddr);  // 下一级页表的paddr debug:(这里编译不过，我加了uint64_t类型转换)
+        pt = (pte4_t *)table;
+        mmu_stats.walk_step_saved_count += 3;
+    }
+    else if(pwc_lookup(MMU_PWC_PDPT, vaddr_value, &table) == 1)
+    {
+        pmd = (pte123_t *)table;
+        mmu_stats.walk_step_saved_count += 2;
+    }
+    else if(pwc_lookup(MMU_PWC_PML4, vaddr_value, &table) == 1)
+    {
+        pud = (pte123_t *)table;
+        mmu_stats.walk_step_saved_count += 1;
+    }
 
-        if(pud[vaddr.vpn2].present == 1)
-        {
-            // find pmd ppn
-            pte123_t *pmd = (pte123_t *)((uint64_t)(pud[vaddr.vpn2].paddr));
+    int steps = 0;
+    page_size_t size = PAGE_4K;
+    uint64_t ppn = 0;
 
-            if(pmd[vaddr.vpn3].present == 1)
-            {
-                // find pt pno
-                
-                pte4_t *pt = (pte4_t *)((uint64_t)(pmd[vaddr.vpn3].paddr));
+    if(pt == NULL && pmd == NULL && pud == NULL)
+    {
+        // pgd
+        steps ++ ;
 
-                if(pt[vaddr.vpn4].present == 1)
-                {
-                    // find page table entry
-                    address_t paddr = {
-                        .ppo = vaddr.vpo,    // page table size 
-                        .ppn = pt[vaddr.vpn4].ppn
-                    };
+        // CR3 register's value is malloced on the heap of this simulator
+        if(cpu_controls.cr3 == 0)
+        {
+            // no address space yet: a new one, switched to like any other
+            mmu_write_cr3((uint64_t)page_table_alloc(PAGE_TABLE_PGD));
+        }
+        pte123_t *pgd = (pte123_t *)((uint64_t)cpu_controls.cr3);           // page global directory
 
-                    return paddr.paddr_value;
-                }
-                else 
-                {
-                    // page table entry not exist
-#ifdef DEBUG_PAGE_WALY
-                    printf("page walk level[4]: pt[%lx].present == 0\n\tmalloc new page table for it\n", vaddr.vpn4);
-#endif        
-                    // map the physical page and the virtual page
-                    // search paddr from main memory and disk
-                    
-                    // TODO: raise exception 14(paging fault here)
-                    // 这里的缺页处理应该交给kernal处理，但是在我们这里我们相当于交给hardware处理了
-
-                    // because this page not exits mm now, so we have to find it in disk
-                    // siwtch privilege from user mode(ring 3) to kernel mode(ring 0)
-                    page_fault_handler(&pt[vaddr.vpn4], vaddr);
-                }
-            }
-            else 
-            {
-                // pt - level 4 not exits
+        if(pgd[vaddr.vpn1].present == 0)
+        {
+            // pud - level 2 not exits
 #ifdef DEBUG_PAGE_WALY
-               printf("page walk level[3]: pmd[%lx].present == 0\n\tmalloc new page table for it\n", vaddr.vpn3);
+            printf("page walk level[1]: pgd[%lx].present == 0\n\tmalloc new page upper table for it\n", vaddr.vpn1);
 #endif        
-                pte4_t *pt = malloc(page_table_size);
-                memset(pt, 0, sizeof(page_table_size));
+            // set page table entry
+            // we only use the bit of present and paddr, and ignore other bits
+            pgd[vaddr.vpn1].present = 1;
+            pgd[vaddr.vpn1].paddr   = (uint64_t)page_table_alloc(PAGE_TABLE_PUD);
+        }
+
+        // vaddr.vpn1 is the offset of the page table - pgd's starting address
+        // starting PHYSICAL PAGE NUMBER of the next level page table
+        // aka. high bits starting address of the page table
+        // aka. (also known as，亦称、也被称为) 
+        // 下一级页表的起始地址，同时我们也认为它是下一级页表的页号
+        pud = (pte123_t *)((uint64_t)pgd[vaddr.vpn1].paddr);  // 下一级页表的paddr debug:(这里编译不过，我加了uint64_t类型转换)
+        pwc_insert(MMU_PWC_PML4, vaddr_value, pud);
+    }
 
-                // set page table entry
-                pmd[vaddr.vpn3].present = 1;
-                pmd[vaddr.vpn3].paddr   = (uint64_t)pt;
+    if(pt == NULL && pmd == NULL)
+    {
+        // pud
+        steps ++ ;
 
-                // TODO: page fault (缺页，与中断有关)
-                // map the physical page and the virtual page
-                exit(0);
-            }
+        if(pud[vaddr.vpn2].present == 0 && huge_region(vaddr_value, PAGE_1G) == 1)
+        {
+            huge_page_fault(&pud[vaddr.vpn2], vaddr, PAGE_1G);
         }
-        else 
-        {        
+
+        if(pud[vaddr.vpn2].present == 0)
+        {
             // pmd - level 3 not exits
 #ifdef DEBUG_PAGE_WALY
             printf("page walk level[2]: pud[%lx].present == 0\n\tmalloc new page middle table for it\n", vaddr.vpn2);
 #endif        
-            pte123_t *pmd = malloc(page_table_size);
-            memset(pmd, 0, sizeof(page_table_size));
-
             // set page table entry
             pud[vaddr.vpn2].present = 1;
-            pud[vaddr.vpn2].paddr   = (uint64_t)pmd;
+            pud[vaddr.vpn2].paddr   = (uint64_t)page_table_alloc(PAGE_TABLE_PMD);
+        }
 
-            // TODO: page fault (缺页，与中断有关)
-            // map the physical page and the virtual page
-            exit(0);
+        if(pud[vaddr.vpn2].pagesize == 1)
+        {
+            // 1GB page
+            size = PAGE_1G;
+            ppn = pud[vaddr.vpn2].paddr;
+        }
+        else
+        {
+            // find pmd ppn
+            pmd = (pte123_t *)((uint64_t)(pud[vaddr.vpn2].paddr));
+            pwc_insert(MMU_PWC_PDPT, vaddr_value, pmd);
+        }
+    }
+
+    if(pt == NULL && size == PAGE_4K)
+    {
+        // pmd
+        steps ++ ;
+
+        if(pmd[vaddr.vpn3].present == 0 && huge_region(vaddr_value, PAGE_2M) == 1)
+        {
+            huge_page_fault(&pmd[vaddr.vpn3], vaddr, PAGE_2M);
+        }
+
+        if(pmd[vaddr.vpn3].present == 0)
+        {
+            // pt - level 4 not exits
+#ifdef DEBUG_PAGE_WALY
+            printf("page walk level[3]: pmd[%lx].present == 0\n\tmalloc new page table for it\n", vaddr.vpn3);
+#endif        
+            // set page table entry
+            pmd[vaddr.vpn3].present = 1;
+            pmd[vaddr.vpn3].paddr   = (uint64_t)page_table_alloc(PAGE_TABLE_PT);
+        }
+
+        if(pmd[vaddr.vpn3].pagesize == 1)
+        {
+            // 2MB page
+            size = PAGE_2M;
+            ppn = pmd[vaddr.vpn3].paddr;
+        }
+        else
+        {
+            // find pt pno
+            pt = (pte4_t *)((uint64_t)(pmd[vaddr.vpn3].paddr));
+            pwc_insert(MMU_PWC_PDE, vaddr_value, pt);
         }
     }
-    else 
+
+    if(size == PAGE_4K)
     {
-        // pud - level 2 not exits
+        // pt
+        steps ++ ;
+
+        if(pt[vaddr.vpn4].present == 0)
+        {
+            // page table entry not exist
 #ifdef DEBUG_PAGE_WALY
-        printf("page walk level[1]: pgd[%lx].present == 0\n\tmalloc new page upper table for it\n", vaddr.vpn1);
+            printf("page walk level[4]: pt[%lx].present == 0\n\tmalloc new page table for it\n", vaddr.vpn4);
 #endif        
-        pte123_t *pud = malloc(page_table_size);
-        memset(pud, 0, sizeof(page_table_size));
+            // map the physical page and the virtual page
+            // search paddr from main memory and disk
+            
+            // TODO: raise exception 14(paging fault here)
+            // 这里的缺页处理应该交给kernal处理，但是在我们这里我们相当于交给hardware处理了
 
-        // set page table entry
-        // we only use the bit of present and paddr, and ignore other bits
-        pgd[vaddr.vpn1].present = 1;
-        pgd[vaddr.vpn1].paddr   = (uint64_t)pud;
+            // because this page not exits mm now, so we have to find it in disk
+            // siwtch privilege from user mode(ring 3) to kernel mode(ring 0)
+            page_fault_handler(&pt[vaddr.vpn4], vaddr);
+        }
+        // the accessed bit, sampled by the page reclaim
+        pt[vaddr.vpn4].reference = 1;
+        ppn = pt[vaddr.vpn4].ppn;
+    }
+    else
+    {
+        // the 4KB page inside the huge page
+        ppn |= (vaddr_value >> VIRTUAL_PAGE_OFFSET_LENGTH) & ((1 << page_size_shifts[size]) - 1);
+    }
 
-        // TODO: page fault (缺页，与中断有关)
-        // map the physical page and the virtual page
-        exit(0);
+    mmu_stats.walk_step_count += steps;
+    mmu_stats.cycles += steps * walk_step_latency;
+
+    // find page table entry, the page is present now
+    *page_size = size;
+    address_t paddr = {
+        .ppo = vaddr.vpo,    // page table size 
+        .ppn = ppn
+    };
+    return paddr.paddr_value;
+}
+
+// CLOCK (page_alloc.c) samples the accessed bit the page walk sets. the TLB entries of the page
+// are dropped with the bit, so that the next access walks again and sets it.
+// a page in the swap cache has no accessed bit: it was never mapped
+static int page_referenced(uint64_t ppn)
+{
+    if(page_map[ppn].swapcache == 1)
+    {
+        return 0;
+    }
+    pte4_t *pte = page_map[ppn].pte4;
+    if(pte->reference == 0)
+    {
+        return 0;
     }
-    return 0; // 作者没有加最后的返回值，我自己加的
+    pte->reference = 0;
+    invalidate_tlbs(page_map[ppn].vpn);
+    return 1;
 }
 
-static void page_fault_handler(pte4_t *pte, address_t vaddr)
+/* ++++++++++++++ swap cache +++++++++++ */
+// the pages read ahead from swap and not mapped yet: their entries are still swapped out,
+// with the swap slot in daddr, so the cache is kept by slot
+static int swap_readahead_pages = 0;
+static int fault_around_pages = 0;
+
+page_fault_stats_t page_fault_stats;
+
+static int64_t *swap_cache = NULL;     // slot -> ppn, -1 for none
+static uint64_t swap_cache_slots = 0;
+
+void mmu_set_swap_readahead(int num_pages)
 {
-    // select one victim physical page to swap
-    assert(pte->present == 0); // means this page not in physical memory
+    assert(num_pages >= 0);
+    swap_readahead_pages = num_pages;
+}
+
+void mmu_set_fault_around(int num_pages)
+{
+    assert(num_pages >= 0);
+    fault_around_pages = num_pages;
+}
+
+static int64_t swap_cache_lookup(uint64_t daddr)
+{
+    if(daddr == 0 || daddr >= swap_cache_slots)
+    {
+        return -1;
+    }
+    int64_t ppn = swap_cache[daddr];
+    // the page may have been released or pm reset since
+    if(ppn < 0 || ppn >= pm_num_pages || page_map[ppn].swapcache == 0 || page_map[ppn].daddr != daddr)
+    {
+        return -1;
+    }
+    return ppn;
+}
+
+static void swap_cache_insert(uint64_t daddr, uint64_t ppn)
+{
+    if(daddr >= swap_cache_slots)
+    {
+        uint64_t slots = swap_cache_slots > 0 ? swap_cache_slots : 64;
+        while(slots <= daddr)
+        {
+            slots *= 2;
+        }
+        swap_cache = realloc(swap_cache, slots * sizeof(int64_t));
+        assert(swap_cache != NULL);
+        for(uint64_t i = swap_cache_slots; i < slots; i ++ )
+        {
+            swap_cache[i] = -1;
+        }
+        swap_cache_slots = slots;
+    }
+    swap_cache[daddr] = ppn;
+    page_map[ppn].swapcache = 1;
+}
+
+static void swap_cache_remove(uint64_t ppn)
+{
+    swap_cache[page_map[ppn].daddr] = -1;
+    page_map[ppn].swapcache = 0;
+}
+
+// the page of vpn is now ppn: the entry was swapped out, its slot goes to page_map
+// and still holds the page as long as it is clean
+static void page_map_pte(pte4_t *pte, uint64_t ppn, uint64_t vpn)
+{
+    uint64_t daddr = pte->daddr;
+
+    pte->pte_value = 0;
+    pte->present = 1;
+    pte->dirty = 0;
+    pte->ppn = ppn;
+
+    page_map[ppn].allocated = 1;   // allocated for vaddr
+    page_map[ppn].dirty = 0;       // allocated for clean
+    page_map[ppn].pte4 = pte;
+    page_map[ppn].vpn = vpn;
+    page_map[ppn].daddr = daddr; // 由于现在当前页在内存当中，因此将daddr放在page_map中
+}
+
+// one physical page for vaddr: a free one, else the victim of CLOCK, which is swapped out
+static uint64_t page_frame(uint64_t vaddr)
+{
+    int64_t ppn = -1;
 
-    // this is the selected ppn for vaddr
-    int ppn = -1;
-    pte4_t *victim = NULL;
-    uint64_t daddr = -1; 
-    int lru_ppn = -1, lru_time = -1;
-    
     // 1. try to request oen free physical page fro mDROM
     // kernal's responsibility
     /* 由于我们需要根据 ppn 的值来判断这一页是否存储在内存中（present）
@@ -291,127 +1324,189 @@ static void page_fault_handler(pte4_t *pte, address_t vaddr)
        所以我们需要增加一个反向映射由 paddr 得到 present
        所以 add 一个 struct -- page_map(memory.h)
     */
-    for(int i = 0; i < MAX_NUM_PHYSICAL_PAGE; i ++ )
+    // the NUMA policy decides which nodes give the page, and in which order
+    int nodes[NUMA_MAX_NODES];
+    int num_nodes = numa_fault_nodes(vaddr, nodes);
+    for(int k = 0; k < num_nodes && ppn < 0; k ++ )
     {
-        if(page_map[i].pte4->present == 0)
-        {
-            printf("PageFault: use free ppn %d\n", i);
-            
-            // found i as free page
-            ppn = i;
-            page_map[ppn].allocated = 1;   // allocated for vaddr
-            page_map[ppn].dirty = 0;       // allocated for clean
-            page_map[ppn].time = 0;        // most recently used physical page
-            page_map[ppn].pte4 = pte;
-            
-            // update old ptr
-            pte->present = 1;
-            pte->dirty = 0;
-            pte->ppn = ppn;
-            
-            return ;
-        }
+        ppn = page_alloc(nodes[k]);
+    }
+
+    if(ppn >= 0)
+    {
+        printf("PageFault: use free ppn %lu\n", ppn);
+        return ppn;
+    }
+
+    // 2. no free physical page: the victim of CLOCK, from the nodes in the same order
+    for(int k = 0; k < num_nodes && ppn < 0; k ++ )
+    {
+        ppn = page_reclaim(nodes[k], page_referenced);
     }
+    assert(ppn >= 0);
 
-    // 2.no free physical page: select a clean page(LRU) overwrite
-    // in this case, there is no DRAM - DISK translation
-    lru_ppn = -1;
-    lru_time = -1;
-    
-    for(int i = 0; i < MAX_NUM_PHYSICAL_PAGE; i ++ )
+    pd_t *pd = &page_map[ppn];
+    if(pd->swapcache == 1)
     {
-        if(page_map[i].dirty == 0 && lru_time < page_map[i].time)
+        // read ahead for nothing: its entry still has the slot, which has the page
+        swap_cache_remove(ppn);
+        page_fault_stats.readahead_miss_count ++ ;
+        return ppn;
+    }
+
+    // page out，将原本的映射删除
+    pte4_t *victim = pd->pte4;
+    victim->pte_value = 0; // reset
+    shootdown_page(ppn, pd->vpn << VIRTUAL_PAGE_OFFSET_LENGTH);
+
+    // write back (swap out) the DIRTY victim to disk, a clean one is already there,
+    // or was never written: it comes back zeroed. no core may write it from then on.
+    // the bulk transfers of swap_out, swap_in and the zero fill write back and invalidate the
+    // lines of the frame in the SRAM cache, so the last stores go to disk and none stays behind
+    /* ppn 与磁盘 swap 建立映射 */
+    if(pd->dirty == 1)
+    {
+        if(pd->daddr == 0)
         {
-            lru_time = page_map[i].time;
-            lru_ppn = i;
+            pd->daddr = swap_alloc();
         }
+        mmu_shootdown_flush();
+        swap_out(pd->daddr, ppn);
+        page_fault_stats.swap_out_count ++ ;
     }
 
-    // found a clean physical page, dont need to page put to disk
-    if(lru_ppn != -1 && lru_time < MAX_NUM_PHYSICAL_PAGE)
-    {
-        ppn = lru_ppn;
+    // reverse mapping
+    /* 维护虚拟页到磁盘的映射
+       1. 如果当前页在内存中，映射关系保存在page_map
+       2. 当前页不在内存中，映射关系由page table保存 */
+    victim->present = 0;
+    victim->daddr = pd->daddr;
+    return ppn;
+}
 
-        // page out，将原本的映射删除
-        victim = page_map[lru_ppn].pte4;
-        
-        // reverse mapping
-        /* 维护虚拟页到磁盘的映射
-           1. 如果当前页在内存中，映射关系保存在page_map
-           2. 当前页不在内存中，映射关系由page table保存 */
-        victim->pte_value = 0; // reset
-        victim->present = 0;
-        victim->daddr = page_map[lru_ppn].daddr;
+// the next pages of the page table of the fault which are swapped out, read with the page of
+// the fault: the fault waits for its own page only, the others land in the swap cache.
+// readahead takes free pages only and stops when there are none: reclaiming for it could
+// evict the page of the fault itself, or the pages read ahead a moment ago
+static void swap_readahead(pte4_t *pte, address_t vaddr)
+{
+    pte4_t *pt = pte - vaddr.vpn4;
+    uint64_t vpn = vaddr.vaddr_value >> VIRTUAL_PAGE_OFFSET_LENGTH;
 
-        // load page from disk to physical memory first
-        /* 由于当前pte的present==0，因此它一定不存在于物理内存当中
-           所以它一定存在于磁盘当中，并且保存了磁盘的地址daddr
-           由于下面的 pte->value=0 会导致我们丢失磁盘地址
-           因此我们必须在这里把磁盘页加载到 ppn */
-        daddr = pte->daddr;
-        swap_in(daddr, ppn);
+    for(uint64_t i = vaddr.vpn4 + 1; i < PAGE_TABLE_ENTRY_NUM && i <= vaddr.vpn4 + swap_readahead_pages; i ++ )
+    {
+        if(pt[i].present == 1 || pt[i].daddr == 0 || swap_cache_lookup(pt[i].daddr) >= 0)
+        {
+            continue;
+        }
 
-        pte->pte_value = 0;
-        pte->present = 1;
-        pte->dirty = 0;
-        pte->ppn = ppn;
-            
-        page_map[lru_ppn].allocated = 1;
-        page_map[lru_ppn].dirty = 0;
-        page_map[lru_ppn].pte4 = pte;
-        page_map[lru_ppn].time = 0;
-        page_map[ppn].daddr = daddr; // 由于现在当前页在内存当中，因此将daddr放在page_map中
+        uint64_t ra_vpn = (vpn & ~(uint64_t)(PAGE_TABLE_ENTRY_NUM - 1)) | i;
+        int nodes[NUMA_MAX_NODES];
+        int num_nodes = numa_fault_nodes(ra_vpn << VIRTUAL_PAGE_OFFSET_LENGTH, nodes);
+        int64_t ppn = -1;
+        for(int k = 0; k < num_nodes && ppn < 0; k ++ )
+        {
+            ppn = page_alloc(nodes[k]);
+        }
+        if(ppn < 0)
+        {
+            break;
+        }
+        swap_in(pt[i].daddr, ppn);
 
-        return ;
+        page_map[ppn].allocated = 1;
+        page_map[ppn].dirty = 0;
+        page_map[ppn].pte4 = &pt[i];
+        page_map[ppn].vpn = ra_vpn;
+        page_map[ppn].daddr = pt[i].daddr;
+        swap_cache_insert(pt[i].daddr, ppn);
+        numa_page_allocated(ppn);
+        page_lru_add(ppn);
+        page_fault_stats.readahead_count ++ ;
     }
+}
+
+// map the pages of the aligned window of the fault found in the swap cache, without their
+// faults. they are not accessed yet: the accessed bit stays clear for CLOCK
+static void fault_around(pte4_t *pte, address_t vaddr)
+{
+    pte4_t *pt = pte - vaddr.vpn4;
+    uint64_t vpn = vaddr.vaddr_value >> VIRTUAL_PAGE_OFFSET_LENGTH;
+    uint64_t start = vaddr.vpn4 - vaddr.vpn4 % fault_around_pages;
 
-    // 3. no free and no clean physical page
-    // write back (swap out) the DIRTY victim to disk
-    lru_ppn = -1;
-    lru_time = -1;
-    
-    for(int i = 0; i < MAX_NUM_PHYSICAL_PAGE; i ++ )
+    for(uint64_t i = start; i < PAGE_TABLE_ENTRY_NUM && i < start + fault_around_pages; i ++ )
     {
-        if(lru_time < page_map[i].time)
+        if(i == vaddr.vpn4 || pt[i].present == 1)
+        {
+            continue;
+        }
+        int64_t ppn = swap_cache_lookup(pt[i].daddr);
+        if(ppn < 0)
         {
-            lru_time = page_map[i].time;
-            lru_ppn = i;
+            continue;
         }
+        swap_cache_remove(ppn);
+        page_map_pte(&pt[i], ppn, (vpn & ~(uint64_t)(PAGE_TABLE_ENTRY_NUM - 1)) | i);
+        page_fault_stats.fault_around_count ++ ;
+        page_fault_stats.readahead_hit_count ++ ;
     }
-    
-    assert(lru_ppn >= 0 && lru_ppn <= MAX_NUM_PHYSICAL_PAGE);
+}
+
+static void page_fault_handler(pte4_t *pte, address_t vaddr)
+{
+    // select one victim physical page to swap
+    assert(pte->present == 0); // means this page not in physical memory
 
-    ppn = lru_ppn;
+    uint64_t vpn = vaddr.vaddr_value >> VIRTUAL_PAGE_OFFSET_LENGTH;
+    uint64_t daddr = pte->daddr;
+    page_fault_stats.fault_count ++ ;
 
-    // reverse mapping
-    victim = page_map[lru_ppn].pte4;
-    
-    // write back
-    /* ppn 与磁盘 swap 建立映射 */
-    swap_out(page_map[ppn].daddr, ppn);
+    // this is the selected ppn for vaddr
+    int64_t ppn = swap_cache_lookup(daddr);
+    if(ppn >= 0)
+    {
+        // minor fault: read ahead by an earlier fault, already on the lists
+        swap_cache_remove(ppn);
+        page_map_pte(pte, ppn, vpn);
+        page_fault_stats.minor_count ++ ;
+        page_fault_stats.readahead_hit_count ++ ;
+    }
+    else
+    {
+        ppn = page_frame(vaddr.vaddr_value);
 
-    victim->pte_value = 0; // reset
-    victim->present = 0;
-    victim->daddr = page_map[lru_ppn].daddr;
+        // load page from disk to physical memory first
+        /* 由于当前pte的present==0，因此它一定不存在于物理内存当中
+           所以它一定存在于磁盘当中，并且保存了磁盘的地址daddr
+           由于下面的 pte->value=0 会导致我们丢失磁盘地址
+           因此我们必须在这里把磁盘页加载到 ppn */
+        if(daddr != 0)
+        {
+            swap_in(daddr, ppn);
+            page_fault_stats.major_count ++ ;
+            page_fault_stats.swap_in_count ++ ;
+        }
+        else
+        {
+            dram_set(ppn << PHYSICAL_PAGE_OFFSET_LENGTH, 0, PHYSICAL_PAGE_SIZE);
+            page_fault_stats.zero_fill_count ++ ;
+        }
 
-    // load page from disk to physical memory first
-    daddr = pte->daddr;
-    swap_in(daddr, ppn);
+        page_map_pte(pte, ppn, vpn);
+        numa_page_allocated(ppn);
+        page_lru_add(ppn);
 
-    pte->pte_value = 0;
-    pte->present = 1;
-    pte->dirty = 0;
-    pte->ppn = ppn;
-        
-    page_map[lru_ppn].allocated = 1;
-    page_map[lru_ppn].dirty = 0;
-    page_map[lru_ppn].pte4 = pte;
-    page_map[lru_ppn].time = 0;
-    page_map[ppn].daddr = daddr; // 由于现在当前页在内存当中，因此将daddr放在page_map中
+        if(daddr != 0 && swap_readahead_pages > 0)
+        {
+            swap_readahead(pte, vaddr);
+        }
+    }
 
-    return ;
+    if(fault_around_pages > 1)
+    {
+        fault_around(pte, vaddr);
+    }
 
-    /* 可以发现，最坏的情况下我们需要扫描三次物理页，这效率也太低了
-        因此这里的函数实现肯定有优化的方法，只不过我们为了简单。。
-    */
-}
\ No newline at end of file
+    // the victims of the fault
+    mmu_shootdown_flush();
+}
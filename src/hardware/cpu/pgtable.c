@@ -0,0 +1,193 @@
+// page table arenas: the tables of an address space are carved out of its own chunks of
+// PAGE_TABLE_CHUNK_SIZE bytes, aligned on their size. a table is one 4KB page of 512 entries,
+// aligned like the tables of the hardware. a freed table goes to the free list of its arena
+// for the next one, and the whole address space goes at once with its chunks, in O(chunks).
+// the first table of each chunk is the header of the chunk, so the arena of a table is found
+// by rounding its address down to the chunk
+// a table is zeroed when it is handed out: no entry is present
+// the page tables live on the heap of the simulator, not in pm (see page_walk in mmu.c)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/memory.h>
+
+#define PAGE_TABLE_SIZE         (PAGE_TABLE_ENTRY_NUM * sizeof(pte123_t))
+#define PAGE_TABLE_CHUNK_SIZE   (2 << 20)
+#define PAGE_TABLES_PER_CHUNK   (PAGE_TABLE_CHUNK_SIZE / PAGE_TABLE_SIZE)
+
+// in the first table of the chunk
+typedef struct PAGE_TABLE_CHUNK_STRUCT
+{
+    page_table_arena_t *arena;
+    struct PAGE_TABLE_CHUNK_STRUCT *next;
+} page_table_chunk_t;
+
+// the free tables, linked through their first entry
+typedef struct PAGE_TABLE_FREE_STRUCT
+{
+    struct PAGE_TABLE_FREE_STRUCT *next;
+} page_table_free_t;
+
+struct PAGE_TABLE_ARENA_STRUCT
+{
+    page_table_chunk_t *chunks;     // the newest first
+    uint64_t next_table;            // the first table never handed out of the newest chunk
+    page_table_free_t *free_tables;
+    page_table_stats_t stats;
+};
+
+static page_table_arena_t default_arena;
+static page_table_arena_t *current = &default_arena;
+
+page_table_arena_t *page_table_arena_construct()
+{
+    page_table_arena_t *a = calloc(1, sizeof(page_table_arena_t));
+    assert(a != NULL);
+    return a;
+}
+
+void page_table_arena_free(page_table_arena_t *a)
+{
+    if(a == NULL)
+    {
+        return;
+    }
+
+    page_table_chunk_t *c = a->chunks;
+    while(c != NULL)
+    {
+        page_table_chunk_t *next = c->next;
+        free(c);
+        c = next;
+    }
+
+    if(current == a)
+    {
+        current = &default_arena;
+    }
+    if(a == &default_arena)
+    {
+        memset(a, 0, sizeof(page_table_arena_t));
+    }
+    else
+    {
+        free(a);
+    }
+}
+
+void page_table_arena_switch(page_table_arena_t *a)
+{
+    current = a != NULL ? a : &default_arena;
+}
+
+page_table_arena_t *page_table_arena_current()
+{
+    return current;
+}
+
+page_table_arena_t *page_table_arena_of(void *table)
+{
+    page_table_chunk_t *c = (page_table_chunk_t *)((uint64_t)table & ~((uint64_t)PAGE_TABLE_CHUNK_SIZE - 1));
+    return c->arena;
+}
+
+int page_table_arena_contains(page_table_arena_t *a, void *table)
+{
+    for(page_table_chunk_t *c = a->chunks; c != NULL; c = c->next)
+    {
+        if((uint64_t)table >= (uint64_t)c && (uint64_t)table < (uint64_t)c + PAGE_TABLE_CHUNK_SIZE)
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static void grow(page_table_arena_t *a)
+{
+    void *p = NULL;
+    if(posix_memalign(&p, PAGE_TABLE_CHUNK_SIZE, PAGE_TABLE_CHUNK_SIZE) != 0)
+    {
+        printf("page table: no memory for a chunk of %d bytes\n", PAGE_TABLE_CHUNK_SIZE);
+        exit(0);
+    }
+
+    page_table_chunk_t *c = p;
+    c->arena = a;
+    c->next = a->chunks;
+    a->chunks = c;
+    a->next_table = 1;      // after the header
+
+    a->stats.chunk_count ++ ;
+    a->stats.reserved_bytes += PAGE_TABLE_CHUNK_SIZE;
+}
+
+void *page_table_alloc(page_table_level_t level)
+{
+    assert(level >= 0 && level < NUM_PAGE_TABLE_LEVELS);
+    page_table_arena_t *a = current;
+
+    void *t = a->free_tables;
+    if(t != NULL)
+    {
+        a->free_tables = a->free_tables->next;
+    }
+    else
+    {
+        if(a->chunks == NULL || a->next_table == PAGE_TABLES_PER_CHUNK)
+        {
+            grow(a);
+        }
+        t = (uint8_t *)a->chunks + a->next_table * PAGE_TABLE_SIZE;
+        a->next_table ++ ;
+    }
+    memset(t, 0, PAGE_TABLE_SIZE);
+
+    a->stats.table_counts[level] ++ ;
+    a->stats.used_bytes += PAGE_TABLE_SIZE;
+    return t;
+}
+
+void page_table_free(void *table, page_table_level_t level)
+{
+    assert(level >= 0 && level < NUM_PAGE_TABLE_LEVELS);
+    if(table == NULL)
+    {
+        return;
+    }
+    page_table_arena_t *a = page_table_arena_of(table);
+    assert(a->stats.table_counts[level] > 0);
+
+    page_table_free_t *t = table;
+    t->next = a->free_tables;
+    a->free_tables = t;
+
+    a->stats.table_counts[level] -- ;
+    a->stats.used_bytes -= PAGE_TABLE_SIZE;
+}
+
+page_table_stats_t *page_table_stats(page_table_arena_t *a)
+{
+    return &(a != NULL ? a : current)->stats;
+}
+
+// of the current address space, the overhead is against the memory resident in pm
+void page_table_print(FILE *fw)
+{
+    page_table_stats_t *s = &current->stats;
+    uint64_t resident = 0;
+    for(uint64_t i = 0; i < pm_num_pages; i ++ )
+    {
+        resident += page_map[i].allocated;
+    }
+    resident *= PHYSICAL_PAGE_SIZE;
+
+    fprintf(fw, "page tables pgd:%lu pud:%lu pmd:%lu pt:%lu used:%lu bytes reserved:%lu bytes in %lu chunks overhead:%.2f%% of %lu resident bytes\n",
+        s->table_counts[PAGE_TABLE_PGD], s->table_counts[PAGE_TABLE_PUD],
+        s->table_counts[PAGE_TABLE_PMD], s->table_counts[PAGE_TABLE_PT],
+        s->used_bytes, s->reserved_bytes, s->chunk_count,
+        resident > 0 ? 100.0 * s->used_bytes / resident : 0.0, resident);
+}
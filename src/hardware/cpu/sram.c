@@ -5,15 +5,35 @@
 #include <string.h>
 #include <headers/address.h>
 #include <headers/memory.h>
+#include <headers/cache.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
 
 #define NUM_CACHE_LINE_PER_SET (8)  // cache 中每个组的 line count
+#define NUM_CACHE_SET          (1 << SRAM_CACHE_INDEX_LENGTH)
+#define CACHE_BLOCK_SIZE       (1 << SRAM_CACHE_OFFSET_LENGTH)
+
+// 3C classification (sram_3c.c)
+void sram_shadow_access(sram_shadow_t *shadow, uint64_t line_addr, uint64_t set_index, int hit, int allocate);
 
+// write buffer of SRAM_WRITE_COMBINING (sram_wbuf.c)
+sram_wbuf_t *sram_wbuf_construct(int num_entries, int offset_length, int store_data);
+void sram_wbuf_free(sram_wbuf_t *wbuf);
+void sram_wbuf_store(sram_cache_t *cache, uint64_t paddr, const uint8_t *data, int size);
+void sram_wbuf_drain_line(sram_cache_t *cache, uint64_t line_addr);
+void sram_wbuf_drain(sram_cache_t *cache);
 
-uint8_t sram_cache_read(uint64_t paddr);
-void sram_cache_write(uint64_t paddr, uint8_t data);
+// victim cache (sram_victim.c)
+int sram_victim_take(sram_cache_t *cache, uint64_t line_addr, uint8_t *state, uint8_t *block);
+void sram_victim_put(sram_cache_t *cache, uint64_t line_addr, uint8_t state, const uint8_t *block);
+void sram_victim_invalidate(sram_cache_t *cache, uint64_t line_addr);
+void sram_victim_invalidate_range(sram_cache_t *cache, uint64_t first, uint64_t last);
+void sram_victim_flush(sram_cache_t *cache);
 
-void bus_read_cacheline (uint64_t paddr, uint8_t *block);
-void bus_write_cacheline(uint64_t paddr, uint8_t *block);
+// cache_lookup() without allocation on miss
+#define NO_LINE (0xffffffffffffffffULL)
 
 
 /* ========================  cache write policy  ============================
@@ -40,6 +60,14 @@ Two cases:
 4. cache read
 if hit, read cache 
 else if miss，read memory and  write cache
+
+5. 本模型中可选的策略（sram_write_policy_t，每个 cache 单独设置）
+    SRAM_WRITE_BACK      : 写回 + 写分配（默认）
+    SRAM_WRITE_THROUGH   : 写穿 + 写不分配，每次 store 都是一次总线写
+    SRAM_WRITE_COMBINING : 写穿 + 写不分配，但 store 先进入合并写缓冲(sram_wbuf.c)，
+                           同一行的多次 store 合并成一次带字节掩码的总线写
+    对于只写不读的流式 store（memset、memcpy 的目的地址），写分配会先把整行读进来再写回，
+    总线流量是写入字节数的两倍；写穿 + 写合并只写一次
 ==========================================================================*/
 
 /*++++++++++++++ define cache struct start +++++++++++++*/
@@ -47,228 +75,499 @@ else if miss，read memory and  write cache
 /*==========================*/
 /*| vallid | clean | dirty |*/
 /*==========================*/
+// the structs are declared in headers/cache.h so that the trace driven
+// simulator (mains/cachesim.c) can build caches of any geometry
+
+#define NUM_DEFAULT_LINES (NUM_CACHE_SET * NUM_CACHE_LINE_PER_SET)
+
+// the cache of the simulated cpu, all lines start as INVALID
+static uint64_t default_tags[NUM_DEFAULT_LINES] = { [0 ... NUM_DEFAULT_LINES - 1] = SRAM_CACHE_TAG_INVALID };
+static uint8_t default_states[NUM_DEFAULT_LINES];
+static uint64_t default_times[NUM_DEFAULT_LINES];
+static uint8_t default_blocks[NUM_DEFAULT_LINES * CACHE_BLOCK_SIZE];
+
+static sram_cache_t cache = {
+    .index_length = SRAM_CACHE_INDEX_LENGTH,
+    .offset_length = SRAM_CACHE_OFFSET_LENGTH,
+    .num_lines_per_set = NUM_CACHE_LINE_PER_SET,
+    .num_sets = NUM_CACHE_SET,
+    .tags = default_tags,
+    .states = default_states,
+    .times = default_times,
+    .blocks = default_blocks,
+};
+/*++++++++++++++ define cache struct end +++++++++++++*/
 
-// write-back and write-allocate
-typedef enum // cache 行中的状态信息
+sram_cache_t *sram_cache_default()
 {
-    CACHE_LINE_INVALID, // 设置为 invalid 更好判断
-    CACHE_LINE_CLEAN,   // In MESI: E, S
-    CACHE_LINE_DIRTY   
-} sram_cacheline_state_t;
-
-/*+---------------------+*/
-/*| state | tag | block |*/
-/*+---------------------+*/
-typedef struct // cache 行
+    return &cache;
+}
+
+sram_cache_t *sram_cache_construct(int index_length, int num_lines_per_set, int offset_length, int store_data)
 {
-    sram_cacheline_state_t state;
-    int time;      // timer to find LRU line inside one set 
-    uint64_t tag;
-    uint8_t block[(1 << SRAM_CACHE_OFFSET_LENGTH)];
-} sram_cacheline_t;
+    assert(index_length >= 0 && index_length < 32);
+    assert(offset_length >= 0 && offset_length < 32);
+    assert(num_lines_per_set > 0);
+
+    sram_cache_t *c = calloc(1, sizeof(sram_cache_t));
+    assert(c != NULL);
+
+    c->index_length = index_length;
+    c->offset_length = offset_length;
+    c->num_lines_per_set = num_lines_per_set;
+    c->num_sets = (uint64_t)1 << index_length;
+
+    uint64_t num_lines = c->num_sets * num_lines_per_set;
+    c->tags = malloc(num_lines * sizeof(uint64_t));
+    c->states = calloc(num_lines, sizeof(uint8_t));  // CACHE_LINE_INVALID == 0
+    c->times = calloc(num_lines, sizeof(uint64_t));
+    assert(c->tags != NULL && c->states != NULL && c->times != NULL);
+    memset(c->tags, 0xff, num_lines * sizeof(uint64_t));   // SRAM_CACHE_TAG_INVALID
+
+    if(store_data != 0)
+    {
+        // the bus moves blocks of the address layout (address.h)
+        assert(offset_length == SRAM_CACHE_OFFSET_LENGTH);
+        c->blocks = calloc(num_lines, (uint64_t)1 << offset_length);
+        assert(c->blocks != NULL);
+    }
 
+    return c;
+}
 
-typedef struct // cache 组
+void sram_cache_free(sram_cache_t *c)
 {
-    sram_cacheline_t lines[NUM_CACHE_LINE_PER_SET];
-} sram_cacheset_t;
+    if(c == NULL || c == &cache)
+    {
+        return;
+    }
+    sram_cache_disable_3c(c);
+    sram_wbuf_free(c->wbuf);
+    sram_cache_disable_mshr(c);
+    sram_cache_disable_victim(c);
+    sram_cache_disable_partition(c);
+    free(c->tags);
+    free(c->states);
+    free(c->times);
+    free(c->blocks);
+    free(c);
+}
+
+void sram_cache_reset_stats(sram_cache_t *c)
+{
+    memset(&c->stats, 0, sizeof(sram_cache_stats_t));
+}
 
-typedef struct // cache
+static inline uint8_t *line_block(sram_cache_t *c, uint64_t line)
 {
-    sram_cacheset_t sets[(1 << SRAM_CACHE_INDEX_LENGTH)];
-} sram_cache_t;
+    return &c->blocks[line << c->offset_length];
+}
 
-static sram_cache_t cache;
-/*++++++++++++++ define cache struct end +++++++++++++*/
+// bitmap of the ways (at most 64) whose tag equals tag, the ways are compared at once
+static inline uint64_t match_ways(const uint64_t *tags, int num_ways, uint64_t tag)
+{
+    uint64_t mask = 0;
+    int i = 0;
+#if defined(__AVX2__)
+    __m256i key = _mm256_set1_epi64x(tag);
+    for(; i + 4 <= num_ways; i += 4)
+    {
+        __m256i eq = _mm256_cmpeq_epi64(_mm256_loadu_si256((const __m256i *)&tags[i]), key);
+        mask |= (uint64_t)_mm256_movemask_pd(_mm256_castsi256_pd(eq)) << i;
+    }
+#elif defined(__SSE2__)
+    // SSE2 has no 64-bit compare: both 32-bit halves of a lane must be equal
+    __m128i key = _mm_set1_epi64x(tag);
+    for(; i + 2 <= num_ways; i += 2)
+    {
+        __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i *)&tags[i]), key);
+        eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, _MM_SHUFFLE(2, 3, 0, 1)));
+        mask |= (uint64_t)_mm_movemask_pd(_mm_castsi128_pd(eq)) << i;
+    }
+#endif
+    for(; i < num_ways; i ++ )
+    {
+        mask |= (uint64_t)(tags[i] == tag) << i;
+    }
+    return mask;
+}
 
+// index (inside the set) of the first way whose tag equals tag, -1 if none
+// the ways are compared 8 at a time: 64 bytes of tags, one host cache line
+static inline int find_way(const uint64_t *tags, int num_ways, uint64_t tag)
+{
+    for(int base = 0; base < num_ways; base += 8)
+    {
+        int n = num_ways - base < 8 ? num_ways - base : 8;
+        uint64_t mask = match_ways(&tags[base], n, tag);
+        if(mask != 0)
+        {
+            return base + __builtin_ctzll(mask);
+        }
+    }
+    return -1;
+}
 
 /* ++++++++++++++ interface ++++++++++++++*/
 /* LRU 替换思路：
-    每次 read 之前，将 cache 中所有 lien 的计数器(time) +1，然后将读取的元素的计数器置为 0
-    这样计数器最大的那个 line 就是最长时间没用到的 line 
+    原本的做法是每次访问之前，将 set 中所有 line 的计数器(time) +1，然后将访问的 line 的计数器置为 0
+    这样计数器最大的那个 line 就是最长时间没用到的 line
+    现在换成等价但更便宜的做法：cache 维护一个全局时钟，每次访问 +1，
+    被访问的 line 记下当前时钟，时钟最小的 valid line 就是 LRU 的 victim
 */
-uint8_t sram_cache_read(uint64_t paddr_value)
+// find the line of paddr (index in the arrays)
+// on miss, the line is allocated (filled from DRAM) if allocate != 0, otherwise NO_LINE is returned
+static uint64_t cache_lookup(sram_cache_t *c, uint64_t paddr, int allocate, sram_cache_result_t *result)
 {
-    address_t paddr = {
-        .paddr_value = paddr_value,
-    };  // NB，这个初始化
-
-    sram_cacheset_t *set = &(cache.sets[paddr.ci]); // 得到这个物理地址所在的 st
-
-    // update LRU time
-    // 这部分相当于预处理，找到 invalid 的行和最久没使用的行方便后面 miss 时更新
-    sram_cacheline_t *victim = NULL; // 将被置换的行称为受害者(victim)，太形象了
-    sram_cacheline_t *invalid = NULL;
-    int max_time = -1;
-    // 暴力循环更新，将所有行的计数器 + 1
-    for(int i = 0; i < NUM_CACHE_LINE_PER_SET; i ++ )  // traver line 
-    {   
-        sram_cacheline_t *line = &(set->lines[i]);
-        line->time ++ ;      
-        if(max_time < line->time)
+    uint64_t line_addr = paddr >> c->offset_length;
+    uint64_t ci = line_addr & (c->num_sets - 1);
+    uint64_t ct = line_addr >> c->index_length;
+    assert(ct != SRAM_CACHE_TAG_INVALID);
+
+    int num_ways = c->num_lines_per_set;
+    uint64_t set = ci * num_ways;   // first line of the set
+    c->clock ++ ;
+
+    int way = find_way(&c->tags[set], num_ways, ct);
+    if(way >= 0)
+    {
+        // cache hit
+        c->times[set + way] = c->clock;
+        c->stats.hit_count ++ ;
+        if(c->partition != NULL)
         {
-            // select this line as victim by LRU policy
-            // replace it with all lines are valid
-            victim = line;
-            max_time = line->time;
+            c->partition->requesters[c->partition->current].hit_count ++ ;
         }
-
-        if(line->state == CACHE_LINE_INVALID)
+        if(c->shadow != NULL)
         {
-            // exits one invalid line as candidate for cache miss
-            invalid = line;
+            sram_shadow_access(c->shadow, line_addr, ci, 1, 1);
         }
+        *result = SRAM_CACHE_HIT;
+        return set + way;
     }
 
-    // try cache hit
-    for(int i = 0; i < NUM_CACHE_LINE_PER_SET;  i ++ )
+    // cache miss: load from memory
+    c->stats.miss_count ++ ;
+    if(c->partition != NULL)
     {
-        sram_cacheline_t line = set->lines[i];
-        
-        if(line.state != CACHE_LINE_INVALID && line.tag == paddr.ct)
-        {
-            // cache hit
-            // find the byte    
-            line.time = 0;
+        c->partition->requesters[c->partition->current].miss_count ++ ;
+    }
+    if(c->shadow != NULL)
+    {
+        sram_shadow_access(c->shadow, line_addr, ci, 0, allocate);
+    }
 
-            return line.block[paddr.co];
-        }
+    if(allocate == 0)
+    {
+        // write no allocate
+        *result = SRAM_CACHE_MISS;
+        return NO_LINE;
     }
 
-    // cache miss:  load from memory
-    
-    // try to find one free cache line
-    if(invalid != NULL)  // 优先使用未使用的块
+    // 优先使用未使用的行：invalid lines keep time 0 while valid lines have time >= 1,
+    // so the least time of the set is the first invalid line if any, otherwise the LRU line
+    // 将被置换的行称为受害者(victim)
+    uint64_t victim = set;
+    uint64_t victim_time;
+    if(c->partition == NULL)
     {
-        // load date from DRAM to this invalid cache line
-        bus_read_cacheline(paddr.address_value, &(invalid->block[0])); // bug: 这里第二个参数我们应该传入一个指针，但是我们传入了一个数组
+        victim_time = c->times[set];
+        for(int i = 1; i < num_ways; i ++ )
+        {
+            // select without branches, the comparison is not predictable
+            uint64_t t = c->times[set + i];
+            int older = t < victim_time;
+            victim_time = older ? t : victim_time;
+            victim = older ? set + i : victim;
+        }
+    }
+    else
+    {
+        // CAT: the victim is chosen among the ways of the requester's mask only,
+        // the other ways look newer than any line (hits still go to all ways)
+        uint64_t mask = c->partition->requesters[c->partition->current].way_mask;
+        victim_time = (mask & 1) ? c->times[set] : ~0ULL;
+        for(int i = 1; i < num_ways; i ++ )
+        {
+            uint64_t t = ((mask >> i) & 1) ? c->times[set + i] : ~0ULL;
+            int older = t < victim_time;
+            victim_time = older ? t : victim_time;
+            victim = older ? set + i : victim;
+        }
+    }
 
-        // update cache line state
-        invalid->state = CACHE_LINE_CLEAN;
+    // the line may have been evicted to the victim cache lately: take it back without DRAM
+    uint8_t state = CACHE_LINE_CLEAN;
+    uint8_t swap[CACHE_BLOCK_SIZE];
+    int from_victim = c->victim != NULL &&
+        sram_victim_take(c, line_addr, &state, c->blocks != NULL ? swap : NULL);
 
-        // uodate LRU
-        invalid->time = 0;
+    if(c->tags[victim] == SRAM_CACHE_TAG_INVALID)
+    {
+        *result = SRAM_CACHE_MISS;
+    }
+    else
+    {
+        c->stats.eviction_count ++ ;
+        *result = SRAM_CACHE_MISS_EVICTION;
 
-        // update tag
-        invalid->tag = paddr.ct;
+        if(c->partition != NULL)
+        {
+            sram_requester_t *owner = &c->partition->requesters[c->partition->owners[victim]];
+            owner->occupancy -- ;
+            owner->evicted_count ++ ;
+        }
 
-        return invalid->block[paddr.co];
+        // the line address of the victim, not of the new line
+        uint64_t victim_line = (c->tags[victim] << c->index_length) | ci;
+        if(c->victim != NULL)
+        {
+            // clean or dirty, the victim cache keeps it
+            sram_victim_put(c, victim_line, c->states[victim], c->blocks != NULL ? line_block(c, victim) : NULL);
+        }
+        // 注意替换出去的 line 是否是 dirty 的
+        else if(c->states[victim] == CACHE_LINE_DIRTY)
+        {
+            c->stats.writeback_count ++ ;
+            c->stats.dram_write_bytes += (uint64_t)1 << c->offset_length;
+            c->stats.dram_write_count ++ ;
+            bus_write_cacheline(victim_line << c->offset_length, c->blocks != NULL ? line_block(c, victim) : NULL);
+        }
     }
 
-    // 只要执行到这里，victim一定是非空的，因为如果victim真的为空
-    // 说明此时是冷启动状态，不存在任何 line
-    // 但此时一定存在 invalid，所以绝对不会执行到这里
-    assert(victim != NULL);
-    // no free cache line, use LRU policy
-    // 注意替换出去的 line 是否是 dirty 的
-    if(victim->state == CACHE_LINE_DIRTY)
-    {                            
-        // write back the dirty line to dram
-        bus_write_cacheline(paddr.paddr_value, victim);
-    } 
-    // update state
-    // 此时该 line 属于未使用状态
-    victim->state = CACHE_LINE_INVALID; 
-    
-    // read from dram
-    // load date from DRAM to this invalid cache line
-    // 现在该 line 被新数据占用了
-    bus_read_cacheline(paddr.address_value, &(victim->block[0]));
+    if(from_victim != 0)
+    {
+        // swapped with the victim, which took the slot freed by this line
+        if(c->blocks != NULL)
+        {
+            memcpy(line_block(c, victim), swap, CACHE_BLOCK_SIZE);
+        }
+    }
+    else
+    {
+        // a store to this line may still be in the write buffer
+        if(c->wbuf != NULL)
+        {
+            sram_wbuf_drain_line(c, line_addr);
+        }
 
-    // update cache line state
-    victim->state = CACHE_LINE_CLEAN;
+        // load data from DRAM to this cache line
+        c->stats.dram_read_bytes += (uint64_t)1 << c->offset_length;
+        bus_read_cacheline(paddr, c->blocks != NULL ? line_block(c, victim) : NULL);
+    }
 
-    // uodate LRU
-    victim->time = 0;
+    c->states[victim] = state;
+    c->tags[victim] = ct;
+    c->times[victim] = c->clock;
 
-    // update tag
-    victim->tag = paddr.ct;
+    if(c->partition != NULL)
+    {
+        c->partition->owners[victim] = c->partition->current;
+        c->partition->requesters[c->partition->current].occupancy ++ ;
+    }
 
-    return victim->block[paddr.co];
+    return victim;
 }
 
+// the store of size bytes at paddr, data is NULL when only the tags are simulated
+static sram_cache_result_t cache_store(sram_cache_t *c, uint64_t paddr, const uint8_t *data, int size)
+{
+    sram_cache_result_t result;
+    uint64_t offset = paddr & (((uint64_t)1 << c->offset_length) - 1);
 
+    if(c->write_policy == SRAM_WRITE_BACK)
+    {
+        // write-back: only mark the line, DRAM is updated when it's evicted
+        uint64_t line = cache_lookup(c, paddr, 1, &result);
+        if(c->blocks != NULL && data != NULL)
+        {
+            memcpy(line_block(c, line) + offset, data, size);
+        }
+        c->states[line] = CACHE_LINE_DIRTY;
+        return result;
+    }
 
-void sram_cache_write(uint64_t paddr_value, uint8_t data)
-{
-    address_t paddr = {
-        .paddr_value = paddr_value, // 将物理地址转换成 address_t 类型方便我们分隔offset，tag和index，
-            // 实际上通过掩码也可以实现，不过不方便
-    }; 
+    // write-through: a hit updates the line which stays clean, a miss goes to DRAM only
+    uint64_t line = cache_lookup(c, paddr, 0, &result);
+    if(line != NO_LINE && c->blocks != NULL && data != NULL)
+    {
+        memcpy(line_block(c, line) + offset, data, size);
+    }
+    if(line == NO_LINE && c->victim != NULL)
+    {
+        // the copy in the victim cache is clean, drop it instead of updating it
+        sram_victim_invalidate(c, paddr >> c->offset_length);
+    }
 
-    sram_cacheset_t *set = &(cache.sets[paddr.ci]); // 只想该物理地址在 cache 中对应的 set
+    if(c->write_policy == SRAM_WRITE_COMBINING)
+    {
+        sram_wbuf_store(c, paddr, data, size);
+    }
+    else
+    {
+        c->stats.dram_write_bytes += size;
+        c->stats.dram_write_count ++ ;
+        bus_write_bytes(paddr, c->blocks != NULL ? data : NULL, size);
+    }
+    return result;
+}
 
-    // 更新 LRU time 并找到 invalid 的行(没使用的行)和最久未使用的行
-    sram_cacheline_t *victim = NULL;
-    sram_cacheline_t *invalid = NULL;
-    int max_time = -1;
+sram_cache_result_t sram_cache_access(sram_cache_t *c, uint64_t paddr, int size, int is_write)
+{
+    sram_cache_result_t result;
 
-    for(int i = 0; i < NUM_CACHE_LINE_PER_SET; i ++ ) // 遍历该 set 中的所有行
+    if(is_write == 0)
     {
-        sram_cacheline_t *line = &(set->lines[i]); // 取得行
-        line->time ++ ;
+        cache_lookup(c, paddr, 1, &result);
+        return result;
+    }
 
-        if(line->state == CACHE_LINE_INVALID) // 未使用
-        {
-            invalid = line;
-        }
+    // the bytes beyond the line belong to the next access
+    uint64_t offset = paddr & (((uint64_t)1 << c->offset_length) - 1);
+    uint64_t room = ((uint64_t)1 << c->offset_length) - offset;
+    size = size <= 0 ? 1 : (size > room ? room : size);
+
+    // no data comes with the access: a write-through cache holding data would write stale bytes
+    assert(c->blocks == NULL || c->write_policy == SRAM_WRITE_BACK);
+    return cache_store(c, paddr, NULL, size);
+}
+
+void sram_cache_set_write_policy(sram_cache_t *c, sram_write_policy_t policy, int wbuf_entries)
+{
+    sram_cache_flush(c);
+    sram_wbuf_free(c->wbuf);
+    c->wbuf = NULL;
 
-        if(max_time < line->time)
+    if(policy == SRAM_WRITE_COMBINING)
+    {
+        if(c->offset_length > 6)
         {
-            victim = line;
-            max_time = line->time;
+            printf("sram: the write buffer takes blocks of at most 64 bytes\n");
+            exit(0);
         }
+        c->wbuf = sram_wbuf_construct(wbuf_entries, c->offset_length, c->blocks != NULL);
     }
+    c->write_policy = policy;
+}
 
-    // 查找 cache
-    // 其实这一步是可以在上面的 for 里面做的，作者之所以这么写是为了让上面的"状态机"更情况
-    for(int i = 0; i < NUM_CACHE_LINE_PER_SET; i ++ )
-    {   
-        sram_cacheline_t *line = &(set->lines[i]);
+void sram_cache_flush(sram_cache_t *c)
+{
+    if(c->wbuf != NULL)
+    {
+        sram_wbuf_drain(c);
+    }
+    if(c->victim != NULL)
+    {
+        sram_victim_flush(c);
+    }
 
-        // cache hit，写回
-        if(line->state != CACHE_LINE_INVALID && line->tag == paddr.ct) 
+    uint64_t num_lines = c->num_sets * c->num_lines_per_set;
+    for(uint64_t i = 0; i < num_lines; i ++ )
+    {
+        if(c->states[i] != CACHE_LINE_DIRTY)
         {
-            // 更新 LRU time
-            line->time = 0;
-
-            // 将数据写入 cache
-            line->block[paddr.co] = data;
+            continue;
+        }
 
-            // 脏数据，更新 state
-            line->state = CACHE_LINE_DIRTY;
+        c->stats.writeback_count ++ ;
+        c->stats.dram_write_bytes += (uint64_t)1 << c->offset_length;
+        c->stats.dram_write_count ++ ;
+        uint64_t ci = i / c->num_lines_per_set;
+        bus_write_cacheline(((c->tags[i] << c->index_length) | ci) << c->offset_length,
+            c->blocks != NULL ? line_block(c, i) : NULL);
+        c->states[i] = CACHE_LINE_CLEAN;
+    }
+}
 
-            return ;
-        }
+// write back and invalidate line i, of line address line_addr
+static void invalidate_line(sram_cache_t *c, uint64_t i, uint64_t line_addr)
+{
+    if(c->states[i] == CACHE_LINE_DIRTY)
+    {
+        c->stats.writeback_count ++ ;
+        c->stats.dram_write_bytes += (uint64_t)1 << c->offset_length;
+        c->stats.dram_write_count ++ ;
+        bus_write_cacheline(line_addr << c->offset_length, c->blocks != NULL ? line_block(c, i) : NULL);
+    }
+    if(c->partition != NULL)
+    {
+        c->partition->requesters[c->partition->owners[i]].occupancy -- ;
     }
 
-    // cache miss，写分配，找到一个 invalid 行或者 victim
-    if(invalid != NULL) // 由 invalid，没使用的行
+    // invalid lines have time 0, they are the first to be refilled
+    c->tags[i] = SRAM_CACHE_TAG_INVALID;
+    c->states[i] = CACHE_LINE_INVALID;
+    c->times[i] = 0;
+}
+
+// the bulk transfers of dram.c go to DRAM directly: a read must see the stores still in the cache,
+// and a write must not leave a stale copy of the line behind
+void sram_cache_flush_range(uint64_t paddr, uint64_t size)
+{
+    sram_cache_t *c = &cache;
+    if(size == 0)
     {
-        bus_read_cacheline(paddr.paddr_value, &(invalid->block)); // 将内存地址中的数据读入行的block
+        return;
+    }
 
-        invalid->state = CACHE_LINE_DIRTY; // 在 cache 中分配一行之后在 cache 中写，再根据写回法写入内存，所以并不一定写入内存，因此是脏数据 
-        invalid->tag = paddr.ct;
-        invalid->block[paddr.co] = data;
+    uint64_t first = paddr >> c->offset_length;
+    uint64_t last = (paddr + size - 1) >> c->offset_length;
+    int num_ways = c->num_lines_per_set;
+    uint64_t num_lines = c->num_sets * num_ways;
 
-        return ;
+    if(c->victim != NULL)
+    {
+        sram_victim_invalidate_range(c, first, last);
     }
 
-    // 一定存在 victim，除非你 cache 中一个 set 只有 0 行
-    assert(victim != NULL);
+    if(last - first >= num_lines)
+    {
+        // more lines than the cache holds (a whole memory): visit the lines of the cache instead
+        if(c->wbuf != NULL)
+        {
+            sram_wbuf_drain(c);
+        }
+        for(uint64_t i = 0; i < num_lines; i ++ )
+        {
+            if(c->tags[i] == SRAM_CACHE_TAG_INVALID)
+            {
+                continue;
+            }
+            uint64_t line_addr = (c->tags[i] << c->index_length) | (i / num_ways);
+            if(first <= line_addr && line_addr <= last)
+            {
+                invalidate_line(c, i, line_addr);
+            }
+        }
+        return;
+    }
 
-    // 如果需要将一行从 cache 中移出，需要检查是否为脏数据
-    if(victim->state == CACHE_LINE_DIRTY) // 是脏数据，写入内存
+    for(uint64_t line_addr = first; line_addr <= last; line_addr ++ )
     {
-        bus_write_cacheline(paddr.paddr_value, victim);
+        if(c->wbuf != NULL)
+        {
+            sram_wbuf_drain_line(c, line_addr);
+        }
+
+        uint64_t set = (line_addr & (c->num_sets - 1)) * num_ways;
+        int way = find_way(&c->tags[set], num_ways, line_addr >> c->index_length);
+        if(way >= 0)
+        {
+            invalidate_line(c, set + way, line_addr);
+        }
     }
-    victim->state = CACHE_LINE_CLEAN;
-    
-    // 将数据写入 cache
-    bus_read_cacheline(paddr.address_value, &(victim->block));
-    victim->state = CACHE_LINE_DIRTY;
-    victim->time = 0;
-    victim->block[paddr.co] = data;
-}   
+}
+
+uint8_t sram_cache_read(uint64_t paddr_value)
+{
+    sram_cache_result_t result;
+    uint64_t line = cache_lookup(&cache, paddr_value, 1, &result);
 
+    return line_block(&cache, line)[paddr_value & (CACHE_BLOCK_SIZE - 1)];
+}
 
+void sram_cache_write(uint64_t paddr_value, uint8_t data)
+{
+    // 写分配时 cache miss：先把行从内存读入 cache，再在 cache 中写
+    cache_store(&cache, paddr_value, &data, 1);
+}
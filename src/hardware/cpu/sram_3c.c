@@ -0,0 +1,300 @@
+// 3C miss classification: compulsory, capacity and conflict misses of the SRAM cache
+// two shadow structures watch the same access stream as the cache:
+//  1. the first-touch set of all line addresses ever accessed
+//  2. a fully associative LRU cache with the same number of lines
+// a miss of the real cache is compulsory if the line was never touched, capacity if the
+// fully associative cache misses as well, and conflict if only the set mapping made it miss
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cache.h>
+
+#define NIL (0xffffffff)
+
+/* one entry per line address ever touched, so the entries are the first-touch set.
+   the entries resident in the fully associative cache are linked in LRU order:
+   head is the most recently used one, tail is the victim
+*/
+typedef struct
+{
+    uint64_t line;
+    uint32_t prev;
+    uint32_t next;
+    int resident;   // in the fully associative cache
+} shadow_entry_t;
+
+struct SRAM_SHADOW_STRUCT
+{
+    shadow_entry_t *entries;    // append only, never freed until the shadow is
+    uint32_t num_entries;
+    uint32_t capacity;
+
+    uint32_t *table;            // open addressing: line -> entry index
+    uint64_t table_size;        // power of 2
+
+    uint32_t head;
+    uint32_t tail;
+    uint64_t num_resident;
+    uint64_t max_resident;      // lines of the real cache
+
+    sram_3c_stats_t stats;
+};
+
+// called by the cache model on each access (sram.c), allocate == 0 for a miss which does not fill
+void sram_shadow_access(sram_shadow_t *shadow, uint64_t line_addr, uint64_t set_index, int hit, int allocate);
+
+static inline uint64_t hash_line(uint64_t line, uint64_t table_size)
+{
+    return (line * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(table_size));
+}
+
+static void table_resize(sram_shadow_t *sh, uint64_t table_size)
+{
+    free(sh->table);
+    sh->table = malloc(table_size * sizeof(uint32_t));
+    assert(sh->table != NULL);
+    memset(sh->table, 0xff, table_size * sizeof(uint32_t));
+    sh->table_size = table_size;
+
+    for(uint32_t i = 0; i < sh->num_entries; i ++ )
+    {
+        uint64_t h = hash_line(sh->entries[i].line, table_size);
+        while(sh->table[h] != NIL)
+        {
+            h = (h + 1) & (table_size - 1);
+        }
+        sh->table[h] = i;
+    }
+}
+
+// find the entry of line, NIL if the line was never touched. *slot is where it would go
+static uint32_t find(sram_shadow_t *sh, uint64_t line, uint64_t *slot)
+{
+    uint64_t h = hash_line(line, sh->table_size);
+    while(sh->table[h] != NIL)
+    {
+        if(sh->entries[sh->table[h]].line == line)
+        {
+            break;
+        }
+        h = (h + 1) & (sh->table_size - 1);
+    }
+    *slot = h;
+    return sh->table[h];
+}
+
+// the line is touched for the first time: its entry goes into the empty slot found by find()
+static uint32_t insert(sram_shadow_t *sh, uint64_t line, uint64_t slot)
+{
+    if(sh->num_entries == sh->capacity)
+    {
+        sh->capacity *= 2;
+        sh->entries = realloc(sh->entries, sh->capacity * sizeof(shadow_entry_t));
+        assert(sh->entries != NULL);
+    }
+
+    uint32_t e = sh->num_entries ++ ;
+    sh->entries[e].line = line;
+    sh->entries[e].prev = NIL;
+    sh->entries[e].next = NIL;
+    sh->entries[e].resident = 0;
+    sh->table[slot] = e;
+
+    // keep the load factor under 1/2
+    if(2 * (uint64_t)sh->num_entries > sh->table_size)
+    {
+        table_resize(sh, sh->table_size * 2);
+    }
+    return e;
+}
+
+static void list_unlink(sram_shadow_t *sh, uint32_t e)
+{
+    shadow_entry_t *x = &sh->entries[e];
+    if(x->prev != NIL)
+    {
+        sh->entries[x->prev].next = x->next;
+    }
+    else
+    {
+        sh->head = x->next;
+    }
+    if(x->next != NIL)
+    {
+        sh->entries[x->next].prev = x->prev;
+    }
+    else
+    {
+        sh->tail = x->prev;
+    }
+    x->prev = NIL;
+    x->next = NIL;
+}
+
+static void list_push_head(sram_shadow_t *sh, uint32_t e)
+{
+    shadow_entry_t *x = &sh->entries[e];
+    x->prev = NIL;
+    x->next = sh->head;
+    if(sh->head != NIL)
+    {
+        sh->entries[sh->head].prev = e;
+    }
+    sh->head = e;
+    if(sh->tail == NIL)
+    {
+        sh->tail = e;
+    }
+}
+
+void sram_shadow_access(sram_shadow_t *sh, uint64_t line_addr, uint64_t set_index, int hit, int allocate)
+{
+    uint64_t slot;
+    uint32_t e = find(sh, line_addr, &slot);
+    int first_touch = e == NIL;
+    int fa_hit = e != NIL && sh->entries[e].resident != 0;
+
+    // a store miss of a no-write-allocate policy leaves the real cache as it was:
+    // it is classified, but the line enters neither the first-touch set nor the shadow cache
+    if(hit != 0 || allocate != 0)
+    {
+        if(first_touch != 0)
+        {
+            e = insert(sh, line_addr, slot);
+        }
+
+        // update the fully associative LRU cache
+        if(fa_hit != 0)
+        {
+            list_unlink(sh, e);
+        }
+        else
+        {
+            if(sh->num_resident == sh->max_resident)
+            {
+                uint32_t victim = sh->tail;
+                list_unlink(sh, victim);
+                sh->entries[victim].resident = 0;
+                sh->num_resident -- ;
+            }
+            sh->entries[e].resident = 1;
+            sh->num_resident ++ ;
+        }
+        list_push_head(sh, e);
+    }
+
+    if(hit != 0)
+    {
+        return;
+    }
+
+    if(first_touch != 0)
+    {
+        sh->stats.compulsory_count ++ ;
+    }
+    else if(fa_hit == 0)
+    {
+        sh->stats.capacity_count ++ ;
+    }
+    else
+    {
+        sh->stats.conflict_count ++ ;
+        sh->stats.conflict_per_set[set_index] ++ ;
+    }
+}
+
+void sram_cache_enable_3c(sram_cache_t *cache)
+{
+    if(cache->shadow != NULL)
+    {
+        return;
+    }
+
+    sram_shadow_t *sh = calloc(1, sizeof(sram_shadow_t));
+    assert(sh != NULL);
+
+    sh->capacity = 4096;
+    sh->entries = malloc(sh->capacity * sizeof(shadow_entry_t));
+    assert(sh->entries != NULL);
+    table_resize(sh, 8192);
+
+    sh->head = NIL;
+    sh->tail = NIL;
+    sh->max_resident = cache->num_sets * cache->num_lines_per_set;
+
+    sh->stats.conflict_per_set = calloc(cache->num_sets, sizeof(uint64_t));
+    assert(sh->stats.conflict_per_set != NULL);
+
+    cache->shadow = sh;
+}
+
+void sram_cache_disable_3c(sram_cache_t *cache)
+{
+    sram_shadow_t *sh = cache->shadow;
+    if(sh == NULL)
+    {
+        return;
+    }
+    free(sh->entries);
+    free(sh->table);
+    free(sh->stats.conflict_per_set);
+    free(sh);
+    cache->shadow = NULL;
+}
+
+sram_3c_stats_t *sram_cache_3c_stats(sram_cache_t *cache)
+{
+    return cache->shadow == NULL ? NULL : &cache->shadow->stats;
+}
+
+// summary and a text heatmap of conflict misses per set, 64 sets per row
+void sram_cache_print_3c(sram_cache_t *cache, FILE *fw)
+{
+    sram_3c_stats_t *st = sram_cache_3c_stats(cache);
+    if(st == NULL)
+    {
+        return;
+    }
+
+    uint64_t misses = st->compulsory_count + st->capacity_count + st->conflict_count;
+    double base = misses > 0 ? 100.0 / misses : 0.0;
+
+    fprintf(fw, "compulsory:%lu capacity:%lu conflict:%lu\n",
+        st->compulsory_count, st->capacity_count, st->conflict_count);
+    fprintf(fw, "compulsory:%.2f%% capacity:%.2f%% conflict:%.2f%%\n",
+        st->compulsory_count * base, st->capacity_count * base, st->conflict_count * base);
+
+    uint64_t max = 0, hottest = 0;
+    for(uint64_t i = 0; i < cache->num_sets; i ++ )
+    {
+        if(st->conflict_per_set[i] > max)
+        {
+            max = st->conflict_per_set[i];
+            hottest = i;
+        }
+    }
+    if(max == 0)
+    {
+        return;
+    }
+
+    // ' ' means no conflict miss, '@' means the hottest set
+    static const char shade[] = " .:-=+*#%@";
+    int levels = sizeof(shade) - 1;
+
+    fprintf(fw, "conflict misses per set (hottest set %lu: %lu, scale \"%s\"):\n", hottest, max, shade);
+    for(uint64_t row = 0; row < cache->num_sets; row += 64)
+    {
+        fprintf(fw, "%6lu |", row);
+        for(uint64_t i = row; i < row + 64 && i < cache->num_sets; i ++ )
+        {
+            uint64_t c = st->conflict_per_set[i];
+            int level = c == 0 ? 0 : 1 + (int)((c * (levels - 2)) / max);
+            fputc(shade[level], fw);
+        }
+        fprintf(fw, "|\n");
+    }
+}
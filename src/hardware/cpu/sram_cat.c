@@ -0,0 +1,100 @@
+// cache way partitioning (Intel Cache Allocation Technology style)
+// the replacement of sram.c honours the way mask of the current requester, this file keeps the
+// masks and the per requester counters. a noisy neighbour shows up as a large evicted_count
+// of the victim requester, partitioning trades it against a smaller share of the cache
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cache.h>
+
+static inline uint64_t all_ways(sram_cache_t *c)
+{
+    return c->num_lines_per_set >= 64 ? ~0ULL : ((uint64_t)1 << c->num_lines_per_set) - 1;
+}
+
+void sram_cache_enable_partition(sram_cache_t *c)
+{
+    if(c->partition != NULL)
+    {
+        return;
+    }
+    if(c->num_lines_per_set > 64)
+    {
+        printf("sram: way masks cover at most 64 ways, the cache has %d\n", c->num_lines_per_set);
+        exit(0);
+    }
+
+    sram_partition_t *p = calloc(1, sizeof(sram_partition_t));
+    assert(p != NULL);
+
+    p->owners = calloc(c->num_sets * c->num_lines_per_set, sizeof(uint8_t));
+    assert(p->owners != NULL);
+
+    for(int i = 0; i < SRAM_CACHE_MAX_REQUESTERS; i ++ )
+    {
+        p->requesters[i].way_mask = all_ways(c);
+    }
+
+    c->partition = p;
+}
+
+void sram_cache_disable_partition(sram_cache_t *c)
+{
+    if(c->partition == NULL)
+    {
+        return;
+    }
+    free(c->partition->owners);
+    free(c->partition);
+    c->partition = NULL;
+}
+
+void sram_cache_set_way_mask(sram_cache_t *c, int requester, uint64_t way_mask)
+{
+    assert(c->partition != NULL);
+    assert(requester >= 0 && requester < SRAM_CACHE_MAX_REQUESTERS);
+
+    // the lines already in the cache stay where they are, like CAT
+    way_mask &= all_ways(c);
+    if(way_mask == 0)
+    {
+        printf("sram: the way mask of requester %d selects no way\n", requester);
+        exit(0);
+    }
+    c->partition->requesters[requester].way_mask = way_mask;
+}
+
+void sram_cache_set_requester(sram_cache_t *c, int requester)
+{
+    assert(requester >= 0 && requester < SRAM_CACHE_MAX_REQUESTERS);
+    if(c->partition != NULL)
+    {
+        c->partition->current = requester;
+    }
+}
+
+// one line per requester which accessed the cache
+void sram_cache_print_partition(sram_cache_t *c, FILE *fw)
+{
+    if(c->partition == NULL)
+    {
+        return;
+    }
+
+    uint64_t num_lines = c->num_sets * c->num_lines_per_set;
+    for(int i = 0; i < SRAM_CACHE_MAX_REQUESTERS; i ++ )
+    {
+        sram_requester_t *r = &c->partition->requesters[i];
+        uint64_t accesses = r->hit_count + r->miss_count;
+        if(accesses == 0)
+        {
+            continue;
+        }
+        fprintf(fw, "requester %d mask:0x%lx hits:%lu misses:%lu miss ratio:%.4f occupancy:%lu (%.1f%%) evicted:%lu\n",
+            i, r->way_mask, r->hit_count, r->miss_count, (double)r->miss_count / accesses,
+            r->occupancy, 100.0 * r->occupancy / num_lines, r->evicted_count);
+    }
+}
@@ -0,0 +1,213 @@
+// non-blocking cache timing: miss status holding registers (MSHRs, Kroft 1981)
+// the functional model (sram.c) decides hit or miss, this file decides when the data arrives.
+// a blocking cache serves one miss at a time, so n independent misses cost n memory latencies;
+// with MSHRs the misses overlap and cost about n / MSHRs latencies, while a pointer chase
+// (each address depends on the data of the previous load) still pays the full latency each time
+//
+// memory level parallelism (MLP) is the average number of busy MSHRs over the cycles when
+// at least one MSHR is busy. MSHRs are allocated in issue order, so the union of the busy
+// intervals is accumulated on allocation without keeping the intervals
+//
+// with the DRAM timing model (dram_timing.c) enabled, a fill is a request to the memory
+// controller, sent when the tag check is done, and the line arrives when the controller says:
+// the memory latency depends on the banks and rows of the access pattern instead of miss_latency
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cache.h>
+#include <headers/memory.h>
+
+struct SRAM_MSHR_STRUCT
+{
+    int num_mshrs;
+    int num_busy;           // busy MSHRs are packed at the head of the arrays
+    uint64_t *lines;        // line address of the miss
+    uint64_t *ready;        // the cycle the line arrives
+
+    uint64_t hit_latency;
+    uint64_t miss_latency;
+
+    uint64_t issue_cycle;   // issue of the last access, the issue is in order
+    uint64_t busy_until;    // end of the union of busy intervals so far
+
+    sram_mshr_stats_t stats;
+};
+
+void sram_cache_enable_mshr(sram_cache_t *c, int num_mshrs, uint64_t hit_latency, uint64_t miss_latency)
+{
+    assert(num_mshrs > 0);
+    sram_cache_disable_mshr(c);
+
+    sram_mshr_t *m = calloc(1, sizeof(sram_mshr_t));
+    assert(m != NULL);
+
+    m->num_mshrs = num_mshrs;
+    m->lines = calloc(num_mshrs, sizeof(uint64_t));
+    m->ready = calloc(num_mshrs, sizeof(uint64_t));
+    assert(m->lines != NULL && m->ready != NULL);
+
+    m->hit_latency = hit_latency;
+    m->miss_latency = miss_latency;
+
+    c->mshr = m;
+}
+
+void sram_cache_disable_mshr(sram_cache_t *c)
+{
+    sram_mshr_t *m = c->mshr;
+    if(m == NULL)
+    {
+        return;
+    }
+    free(m->lines);
+    free(m->ready);
+    free(m);
+    c->mshr = NULL;
+}
+
+sram_mshr_stats_t *sram_cache_mshr_stats(sram_cache_t *c)
+{
+    return c->mshr == NULL ? NULL : &c->mshr->stats;
+}
+
+// free the MSHRs whose line has arrived by cycle
+static void retire(sram_mshr_t *m, uint64_t cycle)
+{
+    int k = 0;
+    for(int i = 0; i < m->num_busy; i ++ )
+    {
+        if(m->ready[i] > cycle)
+        {
+            m->lines[k] = m->lines[i];
+            m->ready[k] = m->ready[i];
+            k ++ ;
+        }
+    }
+    m->num_busy = k;
+}
+
+static int find_pending(sram_mshr_t *m, uint64_t line_addr)
+{
+    for(int i = 0; i < m->num_busy; i ++ )
+    {
+        if(m->lines[i] == line_addr)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// free MSHR i before its line arrives, the last busy one takes its place
+static void release(sram_mshr_t *m, int i)
+{
+    m->num_busy -- ;
+    m->lines[i] = m->lines[m->num_busy];
+    m->ready[i] = m->ready[m->num_busy];
+}
+
+static uint64_t earliest_ready(sram_mshr_t *m)
+{
+    uint64_t t = m->ready[0];
+    for(int i = 1; i < m->num_busy; i ++ )
+    {
+        t = m->ready[i] < t ? m->ready[i] : t;
+    }
+    return t;
+}
+
+// MSHR of a primary miss issued at cycle, the line arrives at ready
+static uint64_t allocate(sram_mshr_t *m, uint64_t line_addr, uint64_t cycle, uint64_t ready)
+{
+    assert(m->num_busy < m->num_mshrs);
+
+    m->lines[m->num_busy] = line_addr;
+    m->ready[m->num_busy] = ready;
+    m->num_busy ++ ;
+
+    m->stats.primary_count ++ ;
+    m->stats.occupancy_cycles += ready - cycle;
+    if(ready > m->busy_until)
+    {
+        m->stats.busy_cycles += ready - (cycle > m->busy_until ? cycle : m->busy_until);
+        m->busy_until = ready;
+    }
+    return ready;
+}
+
+sram_cache_result_t sram_cache_access_at(sram_cache_t *c, uint64_t paddr, int size, int is_write,
+    uint64_t *cycle, uint64_t *done)
+{
+    sram_mshr_t *m = c->mshr;
+    assert(m != NULL);
+
+    uint64_t line_addr = paddr >> c->offset_length;
+    uint64_t t = *cycle > m->issue_cycle ? *cycle : m->issue_cycle;
+    retire(m, t);
+
+    // the functional model installs the line at once, the MSHR tells whether it has arrived
+    int pending = find_pending(m, line_addr);
+    uint64_t read_bytes = c->stats.dram_read_bytes;
+
+    // a new miss can not issue before an MSHR is free
+    uint64_t issue = (pending < 0 && m->num_busy == m->num_mshrs) ? earliest_ready(m) : t;
+    dram_timing_clock = issue + m->hit_latency;
+    sram_cache_result_t result = sram_cache_access(c, paddr, size, is_write);
+
+    // only a fill from DRAM waits for memory: write misses of write-through caches and
+    // lines swapped back from the victim cache do not
+    int fill = c->stats.dram_read_bytes != read_bytes;
+
+    if(fill != 0 && pending >= 0)
+    {
+        // the line was evicted while its fill was in flight and is read from DRAM again:
+        // a new primary miss, which takes over the MSHR of the stale request
+        release(m, pending);
+        pending = -1;
+    }
+
+    uint64_t d;
+    if(pending >= 0)
+    {
+        // secondary miss: wait for the line already requested
+        m->stats.secondary_count ++ ;
+        d = m->ready[pending];
+    }
+    else if(fill != 0)
+    {
+        if(m->num_busy == m->num_mshrs)
+        {
+            uint64_t free_at = earliest_ready(m);
+            m->stats.full_count ++ ;
+            m->stats.stall_cycles += free_at - t;
+            t = free_at;
+            retire(m, t);
+        }
+        // the DRAM model has timed the fill already
+        uint64_t ready = dram_timing_enabled != 0 ? dram_timing_ready : t + m->hit_latency + m->miss_latency;
+        d = allocate(m, line_addr, t, ready);
+    }
+    else
+    {
+        d = t + m->hit_latency;
+    }
+
+    if(is_write != 0)
+    {
+        // the store retires into the store buffer, the fill goes on in the MSHR
+        d = t + m->hit_latency;
+    }
+
+    m->issue_cycle = t;
+    if(d > m->stats.cycles)
+    {
+        m->stats.cycles = d;
+    }
+
+    *cycle = t;
+    *done = d;
+    return result;
+}
@@ -0,0 +1,464 @@
+// single pass cache size sweep by LRU stack distance (Mattson et al. 1970)
+// instead of simulating every (sets, ways) configuration one by one, the stack distance of
+// each access is measured once per set count, and the hits of all associativities follow
+// from the histogram: hits(S, E) = sum of histogram[S][d] for d < E
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <headers/cache.h>
+
+/* The LRU stack of one set is an order statistic treap keyed by the time of last use.
+   The stack distance of a line is the number of lines in its set used after it,
+   i.e. the count of keys greater than its key: O(log E).
+   Lines deeper than max_ways miss in every answered configuration, so each stack only
+   keeps the max_ways most recent lines and the memory is bounded by sets * max_ways.
+   A hash table (chained through the nodes) maps the line address to its node.
+*/
+
+#define NIL (0xffffffff)
+
+typedef struct
+{
+    uint64_t key;       // time of last use
+    uint64_t line;      // line address: paddr >> b
+    uint32_t left;
+    uint32_t right;
+    uint32_t size;      // nodes in this sub-tree
+    uint32_t priority;
+    uint32_t hnext;     // next node in the hash bucket
+} treap_node_t;
+
+// one unit of work: the sets of one set count with (set index % num_groups == group)
+typedef struct
+{
+    int index_length;
+    uint64_t group;
+    uint64_t num_groups;
+    uint64_t *histogram;    // max_ways + 1 counters
+} sweep_unit_t;
+
+typedef struct
+{
+    treap_node_t *nodes;
+    uint32_t num_nodes;
+    uint32_t capacity;
+    uint32_t free_list;     // chained through hnext
+
+    uint32_t *buckets;
+    uint64_t num_buckets;
+    uint32_t num_used;      // nodes linked in the hash table
+
+    uint32_t *roots;        // the stack of each set, indexed by set index / num_groups
+
+    uint32_t seed;
+} sweep_state_t;
+
+typedef struct
+{
+    sram_sweep_t *sweep;
+    const uint64_t *paddrs;
+    uint64_t count;
+
+    sweep_unit_t *units;
+    int num_units;
+    int next_unit;
+    pthread_mutex_t lock;
+} sweep_job_t;
+
+/*======================================*/
+/*      order statistic treap           */
+/*======================================*/
+
+static inline uint32_t node_size(sweep_state_t *st, uint32_t n)
+{
+    return n == NIL ? 0 : st->nodes[n].size;
+}
+
+static inline void node_update(sweep_state_t *st, uint32_t n)
+{
+    treap_node_t *x = &st->nodes[n];
+    x->size = 1 + node_size(st, x->left) + node_size(st, x->right);
+}
+
+// all keys of a are less than the keys of b
+static uint32_t treap_merge(sweep_state_t *st, uint32_t a, uint32_t b)
+{
+    if(a == NIL)
+    {
+        return b;
+    }
+    if(b == NIL)
+    {
+        return a;
+    }
+    if(st->nodes[a].priority > st->nodes[b].priority)
+    {
+        st->nodes[a].right = treap_merge(st, st->nodes[a].right, b);
+        node_update(st, a);
+        return a;
+    }
+    st->nodes[b].left = treap_merge(st, a, st->nodes[b].left);
+    node_update(st, b);
+    return b;
+}
+
+// number of keys greater than key
+static uint32_t treap_count_greater(sweep_state_t *st, uint32_t n, uint64_t key)
+{
+    uint32_t count = 0;
+    while(n != NIL)
+    {
+        treap_node_t *x = &st->nodes[n];
+        if(key < x->key)
+        {
+            count += 1 + node_size(st, x->right);
+            n = x->left;
+        }
+        else
+        {
+            n = x->right;
+        }
+    }
+    return count;
+}
+
+static uint32_t treap_erase(sweep_state_t *st, uint32_t n, uint64_t key)
+{
+    assert(n != NIL);
+    treap_node_t *x = &st->nodes[n];
+    if(key == x->key)
+    {
+        return treap_merge(st, x->left, x->right);
+    }
+    if(key < x->key)
+    {
+        x->left = treap_erase(st, x->left, key);
+    }
+    else
+    {
+        x->right = treap_erase(st, x->right, key);
+    }
+    node_update(st, n);
+    return n;
+}
+
+// detach the node with the least key (the LRU line), return the new root
+static uint32_t treap_erase_min(sweep_state_t *st, uint32_t n, uint32_t *min)
+{
+    treap_node_t *x = &st->nodes[n];
+    if(x->left == NIL)
+    {
+        *min = n;
+        return x->right;
+    }
+    x->left = treap_erase_min(st, x->left, min);
+    node_update(st, n);
+    return n;
+}
+
+/*======================================*/
+/*      line -> node hash table         */
+/*======================================*/
+
+static inline uint64_t hash_line(uint64_t line, uint64_t num_buckets)
+{
+    // fibonacci hashing
+    return (line * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(num_buckets));
+}
+
+static void hash_resize(sweep_state_t *st, uint64_t num_buckets)
+{
+    free(st->buckets);
+    st->buckets = malloc(num_buckets * sizeof(uint32_t));
+    assert(st->buckets != NULL);
+    memset(st->buckets, 0xff, num_buckets * sizeof(uint32_t));
+    st->num_buckets = num_buckets;
+
+    // relink all nodes in use, free nodes are marked by size 0
+    for(uint32_t i = 0; i < st->num_nodes; i ++ )
+    {
+        if(st->nodes[i].size != 0)
+        {
+            uint64_t h = hash_line(st->nodes[i].line, num_buckets);
+            st->nodes[i].hnext = st->buckets[h];
+            st->buckets[h] = i;
+        }
+    }
+}
+
+static inline uint32_t hash_find(sweep_state_t *st, uint64_t line)
+{
+    uint32_t n = st->buckets[hash_line(line, st->num_buckets)];
+    while(n != NIL && st->nodes[n].line != line)
+    {
+        n = st->nodes[n].hnext;
+    }
+    return n;
+}
+
+static void hash_remove(sweep_state_t *st, uint32_t n)
+{
+    uint32_t *p = &st->buckets[hash_line(st->nodes[n].line, st->num_buckets)];
+    while(*p != n)
+    {
+        assert(*p != NIL);
+        p = &st->nodes[*p].hnext;
+    }
+    *p = st->nodes[n].hnext;
+    st->num_used -- ;
+}
+
+static uint32_t node_alloc(sweep_state_t *st, uint64_t line)
+{
+    uint32_t n;
+    if(st->free_list != NIL)
+    {
+        n = st->free_list;
+        st->free_list = st->nodes[n].hnext;
+    }
+    else
+    {
+        if(st->num_nodes == st->capacity)
+        {
+            st->capacity = st->capacity == 0 ? 4096 : st->capacity * 2;
+            st->nodes = realloc(st->nodes, st->capacity * sizeof(treap_node_t));
+            assert(st->nodes != NULL);
+        }
+        n = st->num_nodes ++ ;
+    }
+
+    // xorshift32 for treap priority
+    st->seed ^= st->seed << 13;
+    st->seed ^= st->seed >> 17;
+    st->seed ^= st->seed << 5;
+
+    treap_node_t *x = &st->nodes[n];
+    x->line = line;
+    x->priority = st->seed;
+
+    st->num_used ++ ;
+    if(st->num_used > 2 * st->num_buckets)
+    {
+        // link the node after resizing so that it's not linked twice
+        x->size = 0;
+        hash_resize(st, st->num_buckets * 2);
+    }
+    uint64_t h = hash_line(line, st->num_buckets);
+    x->hnext = st->buckets[h];
+    st->buckets[h] = n;
+
+    return n;
+}
+
+static void node_release(sweep_state_t *st, uint32_t n)
+{
+    hash_remove(st, n);
+    st->nodes[n].size = 0;
+    st->nodes[n].hnext = st->free_list;
+    st->free_list = n;
+}
+
+/*======================================*/
+/*      sweep                           */
+/*======================================*/
+
+static void run_unit(sram_sweep_t *sweep, sweep_unit_t *unit, const uint64_t *paddrs, uint64_t count)
+{
+    uint64_t set_mask = ((uint64_t)1 << unit->index_length) - 1;
+    uint64_t num_roots = (set_mask + unit->num_groups) / unit->num_groups;
+    uint32_t max_ways = sweep->max_ways;
+
+    sweep_state_t st;
+    memset(&st, 0, sizeof(st));
+    st.free_list = NIL;
+    st.seed = 0x12345678 ^ (uint32_t)unit->group;
+    st.roots = malloc(num_roots * sizeof(uint32_t));
+    assert(st.roots != NULL);
+    memset(st.roots, 0xff, num_roots * sizeof(uint32_t));
+    hash_resize(&st, 1 << 12);
+
+    for(uint64_t i = 0; i < count; i ++ )
+    {
+        uint64_t line = paddrs[i] >> sweep->offset_length;
+        uint64_t set = line & set_mask;
+        if(set % unit->num_groups != unit->group)
+        {
+            continue;
+        }
+        uint32_t *root = &st.roots[set / unit->num_groups];
+
+        uint32_t n = hash_find(&st, line);
+        if(n != NIL)
+        {
+            // the line is in the stack: its distance is the count of lines used after it
+            uint32_t distance = treap_count_greater(&st, *root, st.nodes[n].key);
+            unit->histogram[distance] ++ ;
+            *root = treap_erase(&st, *root, st.nodes[n].key);
+        }
+        else
+        {
+            // cold or deeper than max_ways: miss in all configurations
+            unit->histogram[max_ways] ++ ;
+            if(node_size(&st, *root) == max_ways)
+            {
+                uint32_t lru;
+                *root = treap_erase_min(&st, *root, &lru);
+                node_release(&st, lru);
+            }
+            n = node_alloc(&st, line);
+        }
+
+        // push to the top of the stack: the greatest key
+        treap_node_t *x = &st.nodes[n];
+        x->key = i;
+        x->left = NIL;
+        x->right = NIL;
+        x->size = 1;
+        *root = treap_merge(&st, *root, n);
+    }
+
+    free(st.nodes);
+    free(st.buckets);
+    free(st.roots);
+}
+
+static void *sweep_thread(void *arg)
+{
+    sweep_job_t *job = (sweep_job_t *)arg;
+
+    while(1)
+    {
+        pthread_mutex_lock(&job->lock);
+        int u = job->next_unit ++ ;
+        pthread_mutex_unlock(&job->lock);
+
+        if(u >= job->num_units)
+        {
+            return NULL;
+        }
+        run_unit(job->sweep, &job->units[u], job->paddrs, job->count);
+    }
+}
+
+sram_sweep_t *sram_sweep_construct(int offset_length, int max_index_length, int max_ways)
+{
+    assert(offset_length >= 0 && max_index_length >= 0 && offset_length + max_index_length < 64);
+    assert(max_ways > 0);
+
+    sram_sweep_t *sweep = calloc(1, sizeof(sram_sweep_t));
+    assert(sweep != NULL);
+
+    sweep->offset_length = offset_length;
+    sweep->max_index_length = max_index_length;
+    sweep->max_ways = max_ways;
+
+    sweep->histograms = calloc(max_index_length + 1, sizeof(uint64_t *));
+    assert(sweep->histograms != NULL);
+    for(int s = 0; s <= max_index_length; s ++ )
+    {
+        sweep->histograms[s] = calloc(max_ways + 1, sizeof(uint64_t));
+        assert(sweep->histograms[s] != NULL);
+    }
+    return sweep;
+}
+
+void sram_sweep_free(sram_sweep_t *sweep)
+{
+    if(sweep == NULL)
+    {
+        return;
+    }
+    for(int s = 0; s <= sweep->max_index_length; s ++ )
+    {
+        free(sweep->histograms[s]);
+    }
+    free(sweep->histograms);
+    free(sweep);
+}
+
+void sram_sweep_run(sram_sweep_t *sweep, const uint64_t *paddrs, uint64_t count, int num_threads)
+{
+    if(num_threads < 1)
+    {
+        num_threads = 1;
+    }
+
+    // each set count is split into at most num_threads groups of sets,
+    // the sets of a group never share lines with other groups so the groups are independent
+    sweep_job_t job = {
+        .sweep = sweep,
+        .paddrs = paddrs,
+        .count = count,
+    };
+    job.units = calloc((sweep->max_index_length + 1) * num_threads, sizeof(sweep_unit_t));
+    assert(job.units != NULL);
+
+    for(int s = 0; s <= sweep->max_index_length; s ++ )
+    {
+        uint64_t num_sets = (uint64_t)1 << s;
+        uint64_t num_groups = num_sets < (uint64_t)num_threads ? num_sets : (uint64_t)num_threads;
+
+        for(uint64_t g = 0; g < num_groups; g ++ )
+        {
+            sweep_unit_t *unit = &job.units[job.num_units ++ ];
+            unit->index_length = s;
+            unit->group = g;
+            unit->num_groups = num_groups;
+            unit->histogram = calloc(sweep->max_ways + 1, sizeof(uint64_t));
+            assert(unit->histogram != NULL);
+        }
+    }
+
+    if(num_threads == 1)
+    {
+        for(int u = 0; u < job.num_units; u ++ )
+        {
+            run_unit(sweep, &job.units[u], paddrs, count);
+        }
+    }
+    else
+    {
+        pthread_t threads[num_threads];
+        pthread_mutex_init(&job.lock, NULL);
+        for(int t = 0; t < num_threads; t ++ )
+        {
+            pthread_create(&threads[t], NULL, sweep_thread, &job);
+        }
+        for(int t = 0; t < num_threads; t ++ )
+        {
+            pthread_join(threads[t], NULL);
+        }
+        pthread_mutex_destroy(&job.lock);
+    }
+
+    // merge the groups
+    for(int u = 0; u < job.num_units; u ++ )
+    {
+        sweep_unit_t *unit = &job.units[u];
+        for(int d = 0; d <= sweep->max_ways; d ++ )
+        {
+            sweep->histograms[unit->index_length][d] += unit->histogram[d];
+        }
+        free(unit->histogram);
+    }
+    free(job.units);
+
+    sweep->num_accesses += count;
+}
+
+uint64_t sram_sweep_hit_count(sram_sweep_t *sweep, int index_length, int ways)
+{
+    assert(index_length >= 0 && index_length <= sweep->max_index_length);
+    assert(ways > 0 && ways <= sweep->max_ways);
+
+    uint64_t hits = 0;
+    for(int d = 0; d < ways; d ++ )
+    {
+        hits += sweep->histograms[index_length][d];
+    }
+    return hits;
+}
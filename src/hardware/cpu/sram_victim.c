@@ -0,0 +1,214 @@
+// victim cache: a few fully associative lines between the cache and the bus
+// every line evicted from the cache (sram.c) is kept here, clean or dirty, and a miss of the
+// cache probes these lines before DRAM. on a hit the two lines swap: the wanted line goes back
+// to its set, and the line evicted for it takes the freed entry. lines which conflict in one set
+// of a direct mapped or 2-way cache ping-pong between the set and the victim cache without
+// touching DRAM, so the victim cache absorbs mostly conflict misses (see the -c report of cachesim)
+//
+// the victim cache is exclusive: a line is either in the cache or here, never in both
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cache.h>
+
+struct SRAM_VICTIM_STRUCT
+{
+    int num_entries;
+    uint64_t clock;         // LRU stamp, as in the cache
+
+    uint64_t *lines;        // line address, SRAM_CACHE_TAG_INVALID for empty entries
+    uint8_t *states;        // sram_cacheline_state_t
+    uint64_t *times;        // 0 for empty entries
+    uint8_t *blocks;        // NULL in tag-only mode
+
+    sram_victim_stats_t stats;
+};
+
+// called by the cache model (sram.c)
+int sram_victim_take(sram_cache_t *cache, uint64_t line_addr, uint8_t *state, uint8_t *block);
+void sram_victim_put(sram_cache_t *cache, uint64_t line_addr, uint8_t state, const uint8_t *block);
+void sram_victim_invalidate(sram_cache_t *cache, uint64_t line_addr);
+void sram_victim_invalidate_range(sram_cache_t *cache, uint64_t first, uint64_t last);
+void sram_victim_flush(sram_cache_t *cache);
+
+void sram_cache_enable_victim(sram_cache_t *c, int num_entries)
+{
+    assert(num_entries > 0);
+    sram_cache_disable_victim(c);
+
+    sram_victim_t *v = calloc(1, sizeof(sram_victim_t));
+    assert(v != NULL);
+
+    v->num_entries = num_entries;
+    v->lines = malloc(num_entries * sizeof(uint64_t));
+    v->states = calloc(num_entries, sizeof(uint8_t));
+    v->times = calloc(num_entries, sizeof(uint64_t));
+    assert(v->lines != NULL && v->states != NULL && v->times != NULL);
+    memset(v->lines, 0xff, num_entries * sizeof(uint64_t));
+
+    if(c->blocks != NULL)
+    {
+        v->blocks = calloc(num_entries, (uint64_t)1 << c->offset_length);
+        assert(v->blocks != NULL);
+    }
+
+    c->victim = v;
+}
+
+void sram_cache_disable_victim(sram_cache_t *c)
+{
+    sram_victim_t *v = c->victim;
+    if(v == NULL)
+    {
+        return;
+    }
+    sram_victim_flush(c);
+    free(v->lines);
+    free(v->states);
+    free(v->times);
+    free(v->blocks);
+    free(v);
+    c->victim = NULL;
+}
+
+sram_victim_stats_t *sram_cache_victim_stats(sram_cache_t *c)
+{
+    return c->victim == NULL ? NULL : &c->victim->stats;
+}
+
+static inline uint8_t *entry_block(sram_cache_t *c, int e)
+{
+    return &c->victim->blocks[(uint64_t)e << c->offset_length];
+}
+
+static int find_entry(sram_victim_t *v, uint64_t line_addr)
+{
+    for(int i = 0; i < v->num_entries; i ++ )
+    {
+        if(v->lines[i] == line_addr)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void write_back(sram_cache_t *c, int e)
+{
+    sram_victim_t *v = c->victim;
+
+    v->stats.writeback_count ++ ;
+    c->stats.writeback_count ++ ;
+    c->stats.dram_write_bytes += (uint64_t)1 << c->offset_length;
+    c->stats.dram_write_count ++ ;
+    bus_write_cacheline(v->lines[e] << c->offset_length, v->blocks != NULL ? entry_block(c, e) : NULL);
+}
+
+int sram_victim_take(sram_cache_t *c, uint64_t line_addr, uint8_t *state, uint8_t *block)
+{
+    sram_victim_t *v = c->victim;
+
+    int e = find_entry(v, line_addr);
+    if(e < 0)
+    {
+        v->stats.miss_count ++ ;
+        return 0;
+    }
+
+    v->stats.hit_count ++ ;
+    *state = v->states[e];
+    if(block != NULL)
+    {
+        memcpy(block, entry_block(c, e), (uint64_t)1 << c->offset_length);
+    }
+
+    // the entry is free for the line evicted in exchange
+    v->lines[e] = SRAM_CACHE_TAG_INVALID;
+    v->states[e] = CACHE_LINE_INVALID;
+    v->times[e] = 0;
+    return 1;
+}
+
+void sram_victim_put(sram_cache_t *c, uint64_t line_addr, uint8_t state, const uint8_t *block)
+{
+    sram_victim_t *v = c->victim;
+
+    // an empty entry (time 0) if any, otherwise the LRU entry
+    int e = 0;
+    for(int i = 1; i < v->num_entries; i ++ )
+    {
+        e = v->times[i] < v->times[e] ? i : e;
+    }
+
+    if(v->lines[e] != SRAM_CACHE_TAG_INVALID)
+    {
+        v->stats.eviction_count ++ ;
+        if(v->states[e] == CACHE_LINE_DIRTY)
+        {
+            write_back(c, e);
+        }
+    }
+
+    v->clock ++ ;
+    v->lines[e] = line_addr;
+    v->states[e] = state;
+    v->times[e] = v->clock;
+    if(block != NULL)
+    {
+        memcpy(entry_block(c, e), block, (uint64_t)1 << c->offset_length);
+    }
+}
+
+void sram_victim_invalidate(sram_cache_t *c, uint64_t line_addr)
+{
+    sram_victim_t *v = c->victim;
+
+    int e = find_entry(v, line_addr);
+    if(e < 0)
+    {
+        return;
+    }
+    assert(v->states[e] != CACHE_LINE_DIRTY);
+
+    v->lines[e] = SRAM_CACHE_TAG_INVALID;
+    v->states[e] = CACHE_LINE_INVALID;
+    v->times[e] = 0;
+}
+
+// the lines [first, last] leave, the dirty ones are written back first
+void sram_victim_invalidate_range(sram_cache_t *c, uint64_t first, uint64_t last)
+{
+    sram_victim_t *v = c->victim;
+
+    for(int i = 0; i < v->num_entries; i ++ )
+    {
+        if(v->lines[i] == SRAM_CACHE_TAG_INVALID || v->lines[i] < first || last < v->lines[i])
+        {
+            continue;
+        }
+        if(v->states[i] == CACHE_LINE_DIRTY)
+        {
+            write_back(c, i);
+        }
+        v->lines[i] = SRAM_CACHE_TAG_INVALID;
+        v->states[i] = CACHE_LINE_INVALID;
+        v->times[i] = 0;
+    }
+}
+
+void sram_victim_flush(sram_cache_t *c)
+{
+    sram_victim_t *v = c->victim;
+
+    for(int i = 0; i < v->num_entries; i ++ )
+    {
+        if(v->lines[i] != SRAM_CACHE_TAG_INVALID && v->states[i] == CACHE_LINE_DIRTY)
+        {
+            write_back(c, i);
+            v->states[i] = CACHE_LINE_CLEAN;
+        }
+    }
+}
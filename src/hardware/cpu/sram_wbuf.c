@@ -0,0 +1,177 @@
+// coalescing write buffer of write-through caches (SRAM_WRITE_COMBINING)
+// stores are not sent to DRAM one by one: a store to a line which already has an entry in the
+// buffer is merged into that entry, and the entry goes to DRAM as one masked write when it is
+// drained. streaming stores to consecutive addresses cost one bus transaction per line
+// instead of one per store, the same idea as the write-combining buffers of x86 cores
+//
+// the entries are drained in FIFO order when the buffer is full, and an entry is drained early
+// when a read miss fills its line, so that the fill reads the up-to-date bytes
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cache.h>
+
+struct SRAM_WBUF_STRUCT
+{
+    int num_entries;
+    int count;          // pending entries
+    int head;           // oldest pending entry, the entries are a ring
+
+    uint64_t *lines;    // line address of each entry
+    uint64_t *masks;    // bit i: byte i of the line is pending
+    uint8_t *data;      // the pending bytes, B bytes per entry, NULL in tag-only mode
+};
+
+// called by the cache model (sram.c)
+sram_wbuf_t *sram_wbuf_construct(int num_entries, int offset_length, int store_data);
+void sram_wbuf_free(sram_wbuf_t *wbuf);
+void sram_wbuf_store(sram_cache_t *cache, uint64_t paddr, const uint8_t *data, int size);
+void sram_wbuf_drain_line(sram_cache_t *cache, uint64_t line_addr);
+void sram_wbuf_drain(sram_cache_t *cache);
+
+sram_wbuf_t *sram_wbuf_construct(int num_entries, int offset_length, int store_data)
+{
+    // the byte mask of an entry is one uint64_t
+    assert(offset_length <= 6);
+    assert(num_entries > 0);
+
+    sram_wbuf_t *wb = calloc(1, sizeof(sram_wbuf_t));
+    assert(wb != NULL);
+
+    wb->num_entries = num_entries;
+    wb->lines = calloc(num_entries, sizeof(uint64_t));
+    wb->masks = calloc(num_entries, sizeof(uint64_t));
+    assert(wb->lines != NULL && wb->masks != NULL);
+
+    if(store_data != 0)
+    {
+        wb->data = calloc(num_entries, (uint64_t)1 << offset_length);
+        assert(wb->data != NULL);
+    }
+    return wb;
+}
+
+void sram_wbuf_free(sram_wbuf_t *wb)
+{
+    if(wb == NULL)
+    {
+        return;
+    }
+    free(wb->lines);
+    free(wb->masks);
+    free(wb->data);
+    free(wb);
+}
+
+static inline int entry_at(sram_wbuf_t *wb, int k)
+{
+    int e = wb->head + k;
+    return e >= wb->num_entries ? e - wb->num_entries : e;
+}
+
+// write entry e to DRAM as one masked transaction
+static void write_entry(sram_cache_t *c, int e)
+{
+    sram_wbuf_t *wb = c->wbuf;
+    uint64_t mask = wb->masks[e];
+
+    c->stats.dram_write_bytes += __builtin_popcountll(mask);
+    c->stats.dram_write_count ++ ;
+    bus_write_masked(wb->lines[e] << c->offset_length,
+        wb->data != NULL ? &wb->data[e << c->offset_length] : NULL, mask);
+    wb->masks[e] = 0;
+}
+
+static void drain_oldest(sram_cache_t *c)
+{
+    sram_wbuf_t *wb = c->wbuf;
+    assert(wb->count > 0);
+
+    write_entry(c, wb->head);
+    wb->head = entry_at(wb, 1);
+    wb->count -- ;
+}
+
+void sram_wbuf_store(sram_cache_t *c, uint64_t paddr, const uint8_t *data, int size)
+{
+    sram_wbuf_t *wb = c->wbuf;
+    uint64_t line_addr = paddr >> c->offset_length;
+    uint64_t offset = paddr & (((uint64_t)1 << c->offset_length) - 1);
+    uint64_t bytes = size >= 64 ? ~0ULL : (((uint64_t)1 << size) - 1) << offset;
+
+    int e = -1;
+    for(int k = 0; k < wb->count; k ++ )
+    {
+        int i = entry_at(wb, k);
+        if(wb->lines[i] == line_addr)
+        {
+            e = i;
+            break;
+        }
+    }
+
+    if(e >= 0)
+    {
+        c->stats.wbuf_merge_count ++ ;
+    }
+    else
+    {
+        if(wb->count == wb->num_entries)
+        {
+            // the store waits for the oldest entry to be written
+            c->stats.wbuf_full_count ++ ;
+            drain_oldest(c);
+        }
+        e = entry_at(wb, wb->count);
+        wb->lines[e] = line_addr;
+        wb->masks[e] = 0;
+        wb->count ++ ;
+    }
+
+    wb->masks[e] |= bytes;
+    if(wb->data != NULL && data != NULL)
+    {
+        memcpy(&wb->data[(e << c->offset_length) + offset], data, size);
+    }
+}
+
+void sram_wbuf_drain_line(sram_cache_t *c, uint64_t line_addr)
+{
+    sram_wbuf_t *wb = c->wbuf;
+
+    for(int k = 0; k < wb->count; k ++ )
+    {
+        int e = entry_at(wb, k);
+        if(wb->lines[e] != line_addr)
+        {
+            continue;
+        }
+
+        write_entry(c, e);
+        // close the gap: the younger entries move one slot towards the head
+        for(int j = k + 1; j < wb->count; j ++ )
+        {
+            int from = entry_at(wb, j), to = entry_at(wb, j - 1);
+            wb->lines[to] = wb->lines[from];
+            wb->masks[to] = wb->masks[from];
+            if(wb->data != NULL)
+            {
+                memcpy(&wb->data[to << c->offset_length], &wb->data[from << c->offset_length],
+                    (uint64_t)1 << c->offset_length);
+            }
+        }
+        wb->count -- ;
+        return;
+    }
+}
+
+void sram_wbuf_drain(sram_cache_t *c)
+{
+    while(c->wbuf->count > 0)
+    {
+        drain_oldest(c);
+    }
+}
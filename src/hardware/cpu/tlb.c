@@ -0,0 +1,179 @@
+// translation lookaside buffer: a set associative cache of page translations, vpn -> ppn
+// the set is the low bits of the vpn and the whole vpn is kept as tag, so a page can be
+// invalidated by its vpn alone. the replacement is LRU, like the SRAM cache (sram.c):
+// an invalid entry has time 0 and is always taken first, so the TLB is deterministic
+// each entry is tagged with the address space ID it was filled in (PCID): the lookups and
+// fills are in the current ASID of the TLB, so the entries of other address spaces stay
+// when it changes, and are flushed by ASID
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cpu.h>
+#include <headers/address.h>
+
+tlb_t *tlb_construct(int index_length, int num_ways)
+{
+    assert(index_length >= 0 && index_length < 32);
+    assert(num_ways > 0);
+
+    tlb_t *t = calloc(1, sizeof(tlb_t));
+    assert(t != NULL);
+
+    t->index_length = index_length;
+    t->num_ways = num_ways;
+    t->num_sets = (uint64_t)1 << index_length;
+
+    uint64_t num_entries = t->num_sets * num_ways;
+    t->vpns = malloc(num_entries * sizeof(uint64_t));
+    t->ppns = calloc(num_entries, sizeof(uint64_t));
+    t->times = calloc(num_entries, sizeof(uint64_t));
+    t->asids = calloc(num_entries, sizeof(int));
+    assert(t->vpns != NULL && t->ppns != NULL && t->times != NULL && t->asids != NULL);
+    memset(t->vpns, 0xff, num_entries * sizeof(uint64_t));     // TLB_VPN_INVALID
+
+    return t;
+}
+
+void tlb_free(tlb_t *t)
+{
+    if(t == NULL)
+    {
+        return;
+    }
+    free(t->vpns);
+    free(t->ppns);
+    free(t->times);
+    free(t->asids);
+    free(t);
+}
+
+static inline uint64_t set_base(tlb_t *t, uint64_t vpn)
+{
+    return (vpn & (t->num_sets - 1)) * t->num_ways;
+}
+
+static int find_entry(tlb_t *t, uint64_t vpn, int asid)
+{
+    uint64_t base = set_base(t, vpn);
+    for(int i = 0; i < t->num_ways; i ++ )
+    {
+        if(t->vpns[base + i] == vpn && t->asids[base + i] == asid)
+        {
+            return base + i;
+        }
+    }
+    return -1;
+}
+
+static inline void invalidate_entry(tlb_t *t, uint64_t e)
+{
+    t->vpns[e] = TLB_VPN_INVALID;
+    t->times[e] = 0;
+}
+
+void tlb_set_asid(tlb_t *t, int asid)
+{
+    assert(asid >= 0);
+    t->asid = asid;
+}
+
+int tlb_lookup(tlb_t *t, uint64_t vpn, uint64_t *ppn)
+{
+    int e = find_entry(t, vpn, t->asid);
+    if(e < 0)
+    {
+        t->stats.miss_count ++ ;
+        return 0;
+    }
+
+    t->stats.hit_count ++ ;
+    t->clock ++ ;
+    t->times[e] = t->clock;
+    *ppn = t->ppns[e];
+    return 1;
+}
+
+void tlb_insert(tlb_t *t, uint64_t vpn, uint64_t ppn)
+{
+    assert(vpn != TLB_VPN_INVALID);
+
+    int e = find_entry(t, vpn, t->asid);
+    if(e < 0)
+    {
+        // an invalid entry (time 0) if any, otherwise the LRU entry
+        uint64_t base = set_base(t, vpn);
+        e = base;
+        for(int i = 1; i < t->num_ways; i ++ )
+        {
+            e = t->times[base + i] < t->times[e] ? base + i : e;
+        }
+        if(t->vpns[e] != TLB_VPN_INVALID)
+        {
+            t->stats.eviction_count ++ ;
+        }
+    }
+
+    t->clock ++ ;
+    t->vpns[e] = vpn;
+    t->ppns[e] = ppn;
+    t->times[e] = t->clock;
+    t->asids[e] = t->asid;
+}
+
+void tlb_invalidate(tlb_t *t, uint64_t vpn)
+{
+    int e = find_entry(t, vpn, t->asid);
+    if(e < 0)
+    {
+        return;
+    }
+    t->stats.invalidate_count ++ ;
+    invalidate_entry(t, e);
+}
+
+void tlb_invalidate_all_asids(tlb_t *t, uint64_t vpn)
+{
+    uint64_t base = set_base(t, vpn);
+    for(int i = 0; i < t->num_ways; i ++ )
+    {
+        if(t->vpns[base + i] == vpn)
+        {
+            t->stats.invalidate_count ++ ;
+            invalidate_entry(t, base + i);
+        }
+    }
+}
+
+void tlb_flush_asid(tlb_t *t, int asid)
+{
+    uint64_t num_entries = t->num_sets * t->num_ways;
+    for(uint64_t e = 0; e < num_entries; e ++ )
+    {
+        if(t->vpns[e] != TLB_VPN_INVALID && t->asids[e] == asid)
+        {
+            invalidate_entry(t, e);
+        }
+    }
+    t->stats.asid_flush_count ++ ;
+}
+
+void tlb_flush(tlb_t *t)
+{
+    uint64_t num_entries = t->num_sets * t->num_ways;
+    memset(t->vpns, 0xff, num_entries * sizeof(uint64_t));
+    memset(t->times, 0, num_entries * sizeof(uint64_t));
+    t->stats.flush_count ++ ;
+}
+
+void tlb_print(tlb_t *t, const char *name, FILE *fw)
+{
+    tlb_stats_t *s = &t->stats;
+    uint64_t accesses = s->hit_count + s->miss_count;
+    fprintf(fw, "%s sets:%lu ways:%d hits:%lu misses:%lu miss ratio:%.4f evictions:%lu invalidations:%lu flushes:%lu asid flushes:%lu\n",
+        name, t->num_sets, t->num_ways, s->hit_count, s->miss_count,
+        accesses > 0 ? (double)s->miss_count / accesses : 0.0,
+        s->eviction_count, s->invalidate_count, s->flush_count, s->asid_flush_count);
+}
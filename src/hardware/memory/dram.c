@@ -1,18 +1,183 @@
 // Dynammic Random Access Memory
 
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <headers/common.h>
 #include <headers/cpu.h>
 #include <headers/memory.h>
 #include <headers/address.h>
+#include <headers/cache.h>
 
-uint8_t sram_cache_read(uint64_t paddr);
-void sram_cache_write(uint64_t paddr, uint8_t data);
+// physical memory and its reversed mapping (declared in memory.h)
+// the default memory is static, physical_memory_init() replaces it with an mmap
+static uint8_t default_pm[PHYSICAL_MEMORY_DEFAULT_SIZE];
+static pd_t default_page_map[PHYSICAL_MEMORY_DEFAULT_SIZE / PHYSICAL_PAGE_SIZE];
 
-void bus_read_cacheline (uint64_t paddr, uint8_t *block);
-void bus_write_cacheline(uint64_t paddr, uint8_t *block);
+uint8_t *pm = default_pm;
+uint64_t pm_size = PHYSICAL_MEMORY_DEFAULT_SIZE;
+uint64_t pm_num_pages = PHYSICAL_MEMORY_DEFAULT_SIZE / PHYSICAL_PAGE_SIZE;
+pd_t *page_map = default_page_map;
+
+// pm is a MAP_SHARED mapping of a file, synced back to the file when freed
+static int pm_shared = 0;
+
+// anonymous memory of the host: zero filled, committed page by page when touched,
+// and not charged to the swap of the host (MAP_NORESERVE)
+static void *map_anonymous(uint64_t length)
+{
+    void *p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(p == MAP_FAILED)
+    {
+        printf("dram: can not map %lu bytes of physical memory\n", length);
+        exit(0);
+    }
+    return p;
+}
+
+// back to the default memory, cleared
+// the page tables, the TLBs and the soft TLB of mmu.c keep frames of the memory: it may only go
+// before the first translation, or once all the address spaces were freed (mmu_free_address_space)
+void physical_memory_free()
+{
+    for(uint64_t i = 0; i < pm_num_pages; i ++ )
+    {
+        assert(page_map[i].allocated == 0);
+    }
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    // written back to the old memory, no line of it may hit in the new one
+    sram_cache_flush_range(0, pm_size);
+#endif
+
+    if(pm != default_pm)
+    {
+        physical_memory_sync();
+        munmap(pm, pm_size);
+        munmap(page_map, pm_num_pages * sizeof(pd_t));
+    }
+    memset(default_pm, 0, sizeof(default_pm));
+    memset(default_page_map, 0, sizeof(default_page_map));
+
+    pm_shared = 0;
+    pm = default_pm;
+    pm_size = PHYSICAL_MEMORY_DEFAULT_SIZE;
+    pm_num_pages = PHYSICAL_MEMORY_DEFAULT_SIZE / PHYSICAL_PAGE_SIZE;
+    page_map = default_page_map;
+    page_alloc_reset();
+}
+
+static void check_size(uint64_t size)
+{
+    if(size == 0 || size % PHYSICAL_PAGE_SIZE != 0 || (size >> PHYSICAL_ADDRESS_LENGTH) != 0)
+    {
+        printf("dram: physical memory of %lu bytes is not a positive multiple of pages below 2^%d\n",
+            size, PHYSICAL_ADDRESS_LENGTH);
+        exit(0);
+    }
+}
+
+void physical_memory_init(uint64_t size)
+{
+    check_size(size);
+    physical_memory_free();
+
+    pm_num_pages = size / PHYSICAL_PAGE_SIZE;
+    pm = map_anonymous(size);
+    page_map = map_anonymous(pm_num_pages * sizeof(pd_t));
+    pm_size = size;
+}
+
+// the file is the memory itself, nothing is copied at startup: the host pages the image in
+// on first touch. a shared mapping writes the stores through to the file (persisted by msync
+// or at the latest by physical_memory_free), a private mapping keeps them in copy-on-write
+// pages of this process, so many simulators can start from one read-only base image.
+// the bytes of a private mapping beyond the end of a short file read as 0, a shared file is
+// extended to size. only pm is in the file: page_map points to page tables of this process
+// and starts empty like with physical_memory_init()
+void physical_memory_map_file(const char *filename, uint64_t size, int shared)
+{
+    check_size(size);
+    physical_memory_free();
+
+    int fd = open(filename, shared != 0 ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    if(fd < 0)
+    {
+        printf("dram: can not open the memory image %s\n", filename);
+        exit(0);
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) < 0)
+    {
+        printf("dram: can not stat the memory image %s\n", filename);
+        exit(0);
+    }
+    uint64_t file_size = st.st_size;
+
+    uint8_t *p;
+    if(shared != 0)
+    {
+        if(file_size < size && ftruncate(fd, size) < 0)
+        {
+            printf("dram: can not extend the memory image %s to %lu bytes\n", filename, size);
+            exit(0);
+        }
+        p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    else
+    {
+        // reserve zeros for all of the memory, then map the image over the head of it.
+        // touching a file mapping past the page holding the end of the file raises SIGBUS
+        p = map_anonymous(size);
+        uint64_t host_page = sysconf(_SC_PAGESIZE);
+        uint64_t length = (file_size < size ? file_size : size);
+        length = (length + host_page - 1) / host_page * host_page;
+        if(length > 0 &&
+            mmap(p, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+        {
+            p = MAP_FAILED;
+        }
+    }
+    // the mapping holds its own reference to the file
+    close(fd);
+
+    if(p == MAP_FAILED)
+    {
+        printf("dram: can not map the memory image %s\n", filename);
+        exit(0);
+    }
+
+    pm_num_pages = size / PHYSICAL_PAGE_SIZE;
+    pm = p;
+    page_map = map_anonymous(pm_num_pages * sizeof(pd_t));
+    pm_size = size;
+    pm_shared = shared != 0;
+}
+
+// write the dirty pages of a shared memory image back to its file
+void physical_memory_sync()
+{
+    if(pm_shared == 0)
+    {
+        return;
+    }
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    // the stores of the cpu may still be dirty lines of the write-back cache
+    sram_cache_flush(sram_cache_default());
+#endif
+    if(msync(pm, pm_size, MS_SYNC) < 0)
+    {
+        printf("dram: can not sync the memory image\n");
+        exit(0);
+    }
+}
 
 /*
 Be careful with the x86-64 little-endian integer encoding
@@ -30,13 +195,18 @@ e.g. write 0x0000-7fd3-57a0-2ae0 to cache, the memory lapping should be:
 // memory accessing used in struction
 uint64_t cpu_read64bits_dram(uint64_t paddr)
 {
+    if(memory_profile_enabled != 0)
+    {
+        memory_profile_access(paddr, 0);
+    }
+
 #ifdef DEBUG_ENABLE_SRAM_CACHE
     // try to load uint64_t from SRAM cache
     // little-endian
     uint64_t _val = 0x0;
     for(int i = 0; i < sizeof(uint64_t); i ++ )
     {
-        _val += (sram_cache_read(paddr + i) << (i * 8));
+        _val += ((uint64_t)sram_cache_read(paddr + i) << (i * 8));
     }
     return _val;
 #endif
@@ -57,6 +227,11 @@ uint64_t cpu_read64bits_dram(uint64_t paddr)
 
 void cpu_write64bits_dram(uint64_t paddr, uint64_t data)
 {
+    if(memory_profile_enabled != 0)
+    {
+        memory_profile_access(paddr, 1);
+    }
+
 #ifdef DEBUG_ENABLE_SRAM_CACHE
     // try to write uint64_t to SRAM cache
     // little-endian
@@ -82,10 +257,7 @@ void cpu_write64bits_dram(uint64_t paddr, uint64_t data)
 
 void cpu_readinst_dram(uint64_t paddr, char *buf)
 {
-    for(int i = 0; i < MAX_INSTRUCTION_CHAR; i ++ )
-    {
-        buf[i] = (char)pm[paddr + i];
-    }
+    dram_copy_from(buf, paddr, MAX_INSTRUCTION_CHAR);
 }
 
 void cpu_writeinst_dram(uint64_t paddr, const char *str)
@@ -93,40 +265,132 @@ void cpu_writeinst_dram(uint64_t paddr, const char *str)
     int len = strlen(str);
     assert(len <= MAX_INSTRUCTION_CHAR);
     // in our simulatation, the instruction is fixed length
-    for(int i = 0; i < MAX_INSTRUCTION_CHAR; i ++ )
-    {
-        if(i < len)
-        {
-            pm[paddr + i] = (uint8_t)str[i];
-        }
-        else 
-        {
-            pm[paddr + i] = 0;    
-        }
-    }
+    dram_copy_to(paddr, str, len);
+    dram_set(paddr + len, 0, MAX_INSTRUCTION_CHAR - len);
+}
+
+
+/* bulk transfer: copy whole ranges between the host and the simulated memory
+    one memcpy/memset, the virtual versions on top of them are in mmu.c
+    the lines of the range are written back and invalidated in the SRAM cache first:
+    the copy reads the last stores of the cpu, and the cpu does not read stale lines after it
+*/
+void dram_copy_to(uint64_t paddr, const void *src, uint64_t size)
+{
+    assert(paddr <= pm_size && size <= pm_size - paddr);
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    sram_cache_flush_range(paddr, size);
+#endif
+    memcpy(&pm[paddr], src, size);
 }
 
+void dram_copy_from(void *dst, uint64_t paddr, uint64_t size)
+{
+    assert(paddr <= pm_size && size <= pm_size - paddr);
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    sram_cache_flush_range(paddr, size);
+#endif
+    memcpy(dst, &pm[paddr], size);
+}
+
+void dram_set(uint64_t paddr, uint8_t value, uint64_t size)
+{
+    assert(paddr <= pm_size && size <= pm_size - paddr);
+#ifdef DEBUG_ENABLE_SRAM_CACHE
+    sram_cache_flush_range(paddr, size);
+#endif
+    memset(&pm[paddr], value, size);
+}
 
 /* interface of I/O Bus: read and write from cache between the SRAM cache and DRAM memory
     每次总线(bus)传输我们都传输一个 cache block
+    write-through 的 cache 则可能只写 block 中的部分字节
+    tag-only caches pass NULL data: the transfer is counted and timed, no byte moves
 */
+bus_traffic_t bus_traffic;
+
 void bus_read_cacheline(uint64_t paddr, uint8_t *block)
 {
     uint64_t dram_base = (paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH;       /*
     将物理地址的偏移量部分置为0，即得到这个物理地址所在行的起始物理地址，因为我们每次往 cache 中读取或者写入的单位都是一行数据 */
  
-    for(int i = 0; i < (1 << SRAM_CACHE_OFFSET_LENGTH); i ++ ) // block 的大小
+    if(block != NULL)
+    {
+        // not dram_copy_from(): the cache itself is asking, there is nothing to flush
+        memcpy(block, &pm[dram_base], 1 << SRAM_CACHE_OFFSET_LENGTH);   // block 的大小
+    }
+    if(dram_timing_enabled != 0)
+    {
+        dram_timing_request(dram_base, 0);
+    }
+    if(numa_num_nodes > 1)
     {
-       block[i] = pm[dram_base + i];
+        numa_access(dram_base);
     }
+
+    bus_traffic.read_bytes += 1 << SRAM_CACHE_OFFSET_LENGTH;
+    bus_traffic.read_count ++ ;
 }
 
 void bus_write_cacheline(uint64_t paddr, uint8_t *block)
 {
     uint64_t dram_base = (paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH;
 
-    for(int i = 0; i < (1 << SRAM_CACHE_OFFSET_LENGTH); i ++ ) 
+    if(block != NULL)
+    {
+        memcpy(&pm[dram_base], block, 1 << SRAM_CACHE_OFFSET_LENGTH);
+    }
+    if(dram_timing_enabled != 0)
+    {
+        dram_timing_request(dram_base, 1);
+    }
+    if(numa_num_nodes > 1)
+    {
+        numa_access(dram_base);
+    }
+
+    bus_traffic.write_bytes += 1 << SRAM_CACHE_OFFSET_LENGTH;
+    bus_traffic.write_count ++ ;
+}
+
+void bus_write_bytes(uint64_t paddr, const uint8_t *data, int size)
+{
+    if(data != NULL)
+    {
+        memcpy(&pm[paddr], data, size);
+    }
+    if(dram_timing_enabled != 0)
+    {
+        dram_timing_request(paddr, 1);
+    }
+    if(numa_num_nodes > 1)
+    {
+        numa_access(paddr);
+    }
+
+    bus_traffic.write_bytes += size;
+    bus_traffic.write_count ++ ;
+}
+
+void bus_write_masked(uint64_t paddr, const uint8_t *block, uint64_t mask)
+{
+    uint64_t dram_base = (paddr >> SRAM_CACHE_OFFSET_LENGTH) << SRAM_CACHE_OFFSET_LENGTH;
+
+    // one transaction with byte enables
+    for(uint64_t m = mask; m != 0 && block != NULL; m &= m - 1)
+    {
+        int i = __builtin_ctzll(m);
+        pm[dram_base + i] = block[i];
+    }
+    if(dram_timing_enabled != 0)
     {
-       pm[dram_base + i] = block[i];
+        dram_timing_request(dram_base, 1);
     }
-}
\ No newline at end of file
+    if(numa_num_nodes > 1)
+    {
+        numa_access(dram_base);
+    }
+
+    bus_traffic.write_bytes += __builtin_popcountll(mask);
+    bus_traffic.write_count ++ ;
+}
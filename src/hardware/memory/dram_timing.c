@@ -0,0 +1,306 @@
+// DRAM timing: channels, ranks, banks and row buffers behind the bus (dram.c)
+//
+// a physical address is split, from the low bits up, into column (the byte in the row),
+// channel, bank, rank and row. each bank has a row buffer: an access to the open row only
+// pays tCAS (row hit), a precharged bank pays tRCD + tCAS to activate the row first (row empty),
+// and another open row pays tRP + tRCD + tCAS to be closed first (row conflict). the line then
+// takes tBURST cycles on the data bus of its channel, shared by all the banks of the channel.
+// the open-page policy leaves the row open for the next access, the closed-page policy
+// precharges the bank after every access (in the background, the bank is busy for tRP)
+//
+// the requests wait in a queue of queue_size entries, and the FR-FCFS scheduler (Rixner 2000)
+// issues first ready, first come, first served: of the requests which can issue at the earliest
+// cycle, row hits go before the others, then the oldest goes first. writes are posted: they
+// wait in the queue until a read is scheduled behind them or the queue is full. a read is
+// scheduled at once, since the requester needs the cycle its data arrives
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/memory.h>
+
+#define NO_ROW (0xffffffffffffffff)
+
+typedef struct
+{
+    uint64_t arrival;       // the cycle the request reached the controller
+    uint64_t seq;           // arrival order
+    uint64_t row;
+    int bank;               // index among the banks of all ranks and channels
+    int channel;
+    int is_write;
+} dram_request_t;
+
+typedef struct
+{
+    uint64_t open_row;      // NO_ROW when precharged
+    uint64_t ready;         // the first cycle the bank takes a new command
+} dram_bank_t;
+
+int dram_timing_enabled = 0;
+uint64_t dram_timing_clock = 0;
+uint64_t dram_timing_ready = 0;
+
+static dram_timing_config_t config;
+static dram_timing_stats_t stats;
+
+static int column_length, channel_length, bank_length, rank_length;
+
+static dram_bank_t *banks;
+static uint64_t *bus_free;      // per channel, the first cycle the data bus is free
+
+static dram_request_t *queue;
+static int queue_count;
+static uint64_t next_seq;
+
+// DDR4-2400 17-17-17 seen from a 3.6 GHz core: 1 DRAM cycle (0.833 ns) is 3 core cycles
+static const dram_timing_config_t default_config = {
+    .channels = 2,
+    .ranks = 1,
+    .banks = 16,
+    .row_size = 8192,
+    .tRCD = 51,
+    .tCAS = 51,
+    .tRP = 51,
+    .tBURST = 12,
+    .page_policy = DRAM_OPEN_PAGE,
+    .queue_size = 32,
+};
+
+const dram_timing_config_t *dram_timing_default_config()
+{
+    return &default_config;
+}
+
+static int log2_exact(uint64_t x, const char *name)
+{
+    if(x == 0 || (x & (x - 1)) != 0)
+    {
+        printf("dram: %s of %lu is not a power of 2\n", name, x);
+        exit(0);
+    }
+    return __builtin_ctzll(x);
+}
+
+void dram_timing_enable(const dram_timing_config_t *cfg)
+{
+    dram_timing_disable();
+
+    config = cfg != NULL ? *cfg : default_config;
+    column_length = log2_exact(config.row_size, "row size");
+    channel_length = log2_exact(config.channels, "channels");
+    bank_length = log2_exact(config.banks, "banks");
+    rank_length = log2_exact(config.ranks, "ranks");
+    if(config.queue_size <= 0)
+    {
+        printf("dram: the request queue needs at least one entry\n");
+        exit(0);
+    }
+
+    int num_banks = config.channels * config.ranks * config.banks;
+    banks = malloc(num_banks * sizeof(dram_bank_t));
+    bus_free = calloc(config.channels, sizeof(uint64_t));
+    queue = malloc(config.queue_size * sizeof(dram_request_t));
+    assert(banks != NULL && bus_free != NULL && queue != NULL);
+
+    for(int i = 0; i < num_banks; i ++ )
+    {
+        banks[i].open_row = NO_ROW;
+        banks[i].ready = 0;
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    queue_count = 0;
+    next_seq = 0;
+    dram_timing_clock = 0;
+    dram_timing_ready = 0;
+    dram_timing_enabled = 1;
+}
+
+void dram_timing_disable()
+{
+    if(dram_timing_enabled == 0)
+    {
+        return;
+    }
+    free(banks);
+    free(bus_free);
+    free(queue);
+    banks = NULL;
+    bus_free = NULL;
+    queue = NULL;
+    dram_timing_enabled = 0;
+}
+
+dram_timing_stats_t *dram_timing_stats()
+{
+    return &stats;
+}
+
+// row:rank:bank:channel:column, consecutive rows of a bank are far apart
+static void map_address(uint64_t paddr, dram_request_t *r)
+{
+    uint64_t x = paddr >> column_length;
+    r->channel = x & (config.channels - 1);
+    x >>= channel_length;
+    int bank = x & (config.banks - 1);
+    x >>= bank_length;
+    int rank = x & (config.ranks - 1);
+    x >>= rank_length;
+    r->row = x;
+    r->bank = (r->channel * config.ranks + rank) * config.banks + bank;
+}
+
+static inline uint64_t earliest_start(dram_request_t *r)
+{
+    uint64_t ready = banks[r->bank].ready;
+    return r->arrival > ready ? r->arrival : ready;
+}
+
+// the queue index of the request FR-FCFS issues next
+static int pick()
+{
+    assert(queue_count > 0);
+
+    uint64_t start = earliest_start(&queue[0]);
+    for(int i = 1; i < queue_count; i ++ )
+    {
+        uint64_t s = earliest_start(&queue[i]);
+        start = s < start ? s : start;
+    }
+
+    // of the requests ready at start: a row hit, then the oldest
+    int best = -1, best_hit = 0;
+    for(int i = 0; i < queue_count; i ++ )
+    {
+        dram_request_t *r = &queue[i];
+        if(earliest_start(r) != start)
+        {
+            continue;
+        }
+        int hit = banks[r->bank].open_row == r->row;
+        if(best < 0 || hit > best_hit || (hit == best_hit && r->seq < queue[best].seq))
+        {
+            best = i;
+            best_hit = hit;
+        }
+    }
+    return best;
+}
+
+// issue queue[i], return the cycle its data transfer ends
+static uint64_t issue(int i)
+{
+    dram_request_t r = queue[i];
+    dram_bank_t *b = &banks[r.bank];
+    uint64_t start = earliest_start(&r);
+
+    // an older request of the same bank is still waiting: FR-FCFS went around it
+    for(int k = 0; k < queue_count; k ++ )
+    {
+        if(queue[k].bank == r.bank && queue[k].seq < r.seq)
+        {
+            stats.reordered_count ++ ;
+            break;
+        }
+    }
+
+    uint64_t latency = config.tCAS;
+    if(b->open_row == r.row)
+    {
+        stats.row_hit_count ++ ;
+    }
+    else if(b->open_row == NO_ROW)
+    {
+        stats.row_empty_count ++ ;
+        latency += config.tRCD;
+    }
+    else
+    {
+        stats.row_conflict_count ++ ;
+        latency += config.tRP + config.tRCD;
+    }
+
+    uint64_t data = start + latency;
+    data = data > bus_free[r.channel] ? data : bus_free[r.channel];
+    uint64_t done = data + config.tBURST;
+    bus_free[r.channel] = done;
+
+    if(config.page_policy == DRAM_OPEN_PAGE)
+    {
+        // the column accesses to the open row are pipelined, one burst apart
+        b->open_row = r.row;
+        b->ready = start + latency - config.tCAS + config.tBURST;
+    }
+    else
+    {
+        b->open_row = NO_ROW;
+        b->ready = done + config.tRP;
+    }
+
+    if(r.is_write == 0)
+    {
+        stats.read_latency_cycles += done - r.arrival;
+    }
+
+    queue[i] = queue[queue_count - 1];
+    queue_count -- ;
+    return done;
+}
+
+uint64_t dram_timing_request(uint64_t paddr, int is_write)
+{
+    assert(dram_timing_enabled != 0);
+
+    while(queue_count == config.queue_size)
+    {
+        issue(pick());
+    }
+
+    dram_request_t *r = &queue[queue_count ++ ];
+    map_address(paddr, r);
+    r->arrival = dram_timing_clock;
+    r->seq = next_seq ++ ;
+    r->is_write = is_write;
+
+    if(is_write != 0)
+    {
+        stats.write_count ++ ;
+        return dram_timing_clock;
+    }
+
+    // everything FR-FCFS puts before the read is issued with it
+    stats.read_count ++ ;
+    uint64_t seq = r->seq;
+    while(1)
+    {
+        int i = pick();
+        int mine = queue[i].seq == seq;
+        uint64_t done = issue(i);
+        if(mine != 0)
+        {
+            dram_timing_ready = done;
+            return done;
+        }
+    }
+}
+
+void dram_timing_drain()
+{
+    while(queue_count > 0)
+    {
+        issue(pick());
+    }
+}
+
+void dram_timing_print(FILE *fw)
+{
+    uint64_t total = stats.row_hit_count + stats.row_empty_count + stats.row_conflict_count;
+    fprintf(fw, "dram reads:%lu writes:%lu row hits:%lu empty:%lu conflicts:%lu row hit ratio:%.4f reordered:%lu avg read latency:%.1f\n",
+        stats.read_count, stats.write_count,
+        stats.row_hit_count, stats.row_empty_count, stats.row_conflict_count,
+        total > 0 ? (double)stats.row_hit_count / total : 0.0, stats.reordered_count,
+        stats.read_count > 0 ? (double)stats.read_latency_cycles / stats.read_count : 0.0);
+}
@@ -0,0 +1,170 @@
+// NUMA: the physical pages are split into nodes, node i holds the i-th contiguous range of pm,
+// like the memory of the sockets of a multi-socket machine. the core runs on numa_current_node,
+// and an access to the memory of another node is remote: it costs the latency of the distance
+// between the two nodes (latencies[from][to], a SLIT table in cycles)
+//
+// the page fault handler (mmu.c) takes its free pages in the order of the allocation policy:
+//  - first-touch: the node of the faulting core, then the other nodes by distance
+//  - interleave:  node vpn % num_nodes first, so consecutive pages go round robin
+//  - bind:        only the bound node, a full node replaces one of its own pages
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/address.h>
+#include <headers/memory.h>
+
+int numa_num_nodes = 0;
+int numa_current_node = 0;
+numa_node_t numa_nodes[NUMA_MAX_NODES];
+
+static numa_policy_t policy = NUMA_FIRST_TOUCH;
+static int bind_node = 0;
+static uint64_t pages_per_node;
+
+void numa_init(int num_nodes, uint64_t local_latency, uint64_t remote_latency)
+{
+    if(num_nodes <= 0 || num_nodes > NUMA_MAX_NODES || num_nodes > pm_num_pages)
+    {
+        printf("numa: %d nodes for %lu physical pages, at most %d nodes\n",
+            num_nodes, pm_num_pages, NUMA_MAX_NODES);
+        exit(0);
+    }
+
+    memset(numa_nodes, 0, sizeof(numa_nodes));
+    numa_num_nodes = num_nodes;
+    numa_current_node = 0;
+    policy = NUMA_FIRST_TOUCH;
+    bind_node = 0;
+
+    // the last node also takes the pages left over
+    pages_per_node = pm_num_pages / num_nodes;
+    for(int i = 0; i < num_nodes; i ++ )
+    {
+        numa_node_t *n = &numa_nodes[i];
+        n->first_page = i * pages_per_node;
+        n->num_pages = i == num_nodes - 1 ? pm_num_pages - n->first_page : pages_per_node;
+        for(int j = 0; j < num_nodes; j ++ )
+        {
+            n->latencies[j] = i == j ? local_latency : remote_latency;
+        }
+    }
+
+    // the free lists are per node
+    page_alloc_reset();
+}
+
+void numa_set_latency(int from, int to, uint64_t latency)
+{
+    assert(from >= 0 && from < numa_num_nodes && to >= 0 && to < numa_num_nodes);
+    numa_nodes[from].latencies[to] = latency;
+}
+
+void numa_set_policy(numa_policy_t p, int node)
+{
+    if(p == NUMA_BIND && (node < 0 || node >= numa_num_nodes))
+    {
+        printf("numa: can not bind to node %d of %d\n", node, numa_num_nodes);
+        exit(0);
+    }
+    policy = p;
+    bind_node = node;
+}
+
+int numa_node_of(uint64_t ppn)
+{
+    if(numa_num_nodes <= 1)
+    {
+        return 0;
+    }
+    uint64_t node = ppn / pages_per_node;
+    return node < numa_num_nodes ? node : numa_num_nodes - 1;
+}
+
+int numa_page_allowed(uint64_t ppn)
+{
+    return numa_num_nodes <= 1 || policy != NUMA_BIND || numa_node_of(ppn) == bind_node;
+}
+
+int numa_fault_nodes(uint64_t vaddr, int *nodes)
+{
+    if(numa_num_nodes <= 1)
+    {
+        nodes[0] = 0;
+        return 1;
+    }
+    if(policy == NUMA_BIND)
+    {
+        nodes[0] = bind_node;
+        return 1;
+    }
+
+    int first = policy == NUMA_INTERLEAVE ?
+        (vaddr >> PHYSICAL_PAGE_OFFSET_LENGTH) % numa_num_nodes : numa_current_node;
+    nodes[0] = first;
+
+    // the other nodes, nearest to the first one first (insertion sort, a handful of nodes)
+    int count = 1;
+    for(int i = 0; i < numa_num_nodes; i ++ )
+    {
+        if(i == first)
+        {
+            continue;
+        }
+        int k = count ++ ;
+        while(k > 1 && numa_nodes[first].latencies[nodes[k - 1]] > numa_nodes[first].latencies[i])
+        {
+            nodes[k] = nodes[k - 1];
+            k -- ;
+        }
+        nodes[k] = i;
+    }
+    return count;
+}
+
+void numa_page_allocated(uint64_t ppn)
+{
+    if(numa_num_nodes > 1)
+    {
+        numa_nodes[numa_node_of(ppn)].allocated_count ++ ;
+    }
+}
+
+uint64_t numa_access(uint64_t paddr)
+{
+    numa_node_t *n = &numa_nodes[numa_node_of(paddr >> PHYSICAL_PAGE_OFFSET_LENGTH)];
+    uint64_t latency = numa_nodes[numa_current_node].latencies[n - numa_nodes];
+
+    if(n == &numa_nodes[numa_current_node])
+    {
+        n->local_count ++ ;
+    }
+    else
+    {
+        n->remote_count ++ ;
+    }
+    n->cycles += latency;
+    return latency;
+}
+
+void numa_print(FILE *fw)
+{
+    static const char *policy_name[] = {
+        [NUMA_FIRST_TOUCH]  = "first-touch",
+        [NUMA_INTERLEAVE]   = "interleave",
+        [NUMA_BIND]         = "bind",
+    };
+
+    fprintf(fw, "numa nodes:%d policy:%s core on node:%d\n",
+        numa_num_nodes, policy_name[policy], numa_current_node);
+    for(int i = 0; i < numa_num_nodes; i ++ )
+    {
+        numa_node_t *n = &numa_nodes[i];
+        uint64_t accesses = n->local_count + n->remote_count;
+        fprintf(fw, "node %d pages:%lu allocated:%lu local:%lu remote:%lu remote ratio:%.4f cycles:%lu\n",
+            i, n->num_pages, n->allocated_count, n->local_count, n->remote_count,
+            accesses > 0 ? (double)n->remote_count / accesses : 0.0, n->cycles);
+    }
+}
@@ -0,0 +1,239 @@
+// physical page allocator: the page fault handler (mmu.c) takes its pages here
+//
+// each NUMA node has three lists of its pages, linked through page_map by ppn:
+//  - free:     never mapped, popped in O(1)
+//  - inactive: mapped pages, the candidates for eviction, the oldest at the head
+//  - active:   mapped pages found referenced on the inactive list
+// a page read ahead into the swap cache is on the inactive list like a mapped one.
+// a new mapping goes to the tail of the inactive list. reclaim takes the head of the inactive
+// list: a page referenced since it was queued gets a second chance on the active list, an
+// unreferenced one is the victim (CLOCK). the active list is aged into the inactive list
+// whenever it is longer, rotating its referenced pages. the reference bit is the accessed bit
+// of the page table entry, tested and cleared by the caller, so each page is passed at most
+// twice per bit set and the victim is found in O(1) amortized.
+// the huge pages are on no list: they are pinned
+//
+// the lists are built from page_map on first use, and again after pm or the NUMA nodes change
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/memory.h>
+
+#define NO_PAGE (-1)
+
+typedef struct
+{
+    int64_t head;
+    int64_t tail;
+    uint64_t count;
+} page_list_t;
+
+static page_list_t lists[NUMA_MAX_NODES][NUM_PAGE_LISTS];
+static int built = 0;
+
+static page_alloc_stats_t stats;
+
+static void list_push(int node, page_list_type_t type, uint64_t ppn)
+{
+    page_list_t *l = &lists[node][type];
+    pd_t *pd = &page_map[ppn];
+
+    pd->list = type;
+    pd->prev = l->tail;
+    pd->next = NO_PAGE;
+    if(l->tail == NO_PAGE)
+    {
+        l->head = ppn;
+    }
+    else
+    {
+        page_map[l->tail].next = ppn;
+    }
+    l->tail = ppn;
+    l->count ++ ;
+}
+
+static void list_remove(uint64_t ppn)
+{
+    pd_t *pd = &page_map[ppn];
+    assert(pd->list != PAGE_LIST_NONE);
+    page_list_t *l = &lists[numa_node_of(ppn)][pd->list];
+
+    if(pd->prev == NO_PAGE)
+    {
+        l->head = pd->next;
+    }
+    else
+    {
+        page_map[pd->prev].next = pd->next;
+    }
+    if(pd->next == NO_PAGE)
+    {
+        l->tail = pd->prev;
+    }
+    else
+    {
+        page_map[pd->next].prev = pd->prev;
+    }
+    l->count -- ;
+    pd->list = PAGE_LIST_NONE;
+}
+
+static void build()
+{
+    if(built != 0)
+    {
+        return;
+    }
+
+    for(int i = 0; i < NUMA_MAX_NODES; i ++ )
+    {
+        for(int j = 0; j < NUM_PAGE_LISTS; j ++ )
+        {
+            lists[i][j].head = NO_PAGE;
+            lists[i][j].tail = NO_PAGE;
+            lists[i][j].count = 0;
+        }
+    }
+
+    for(uint64_t i = 0; i < pm_num_pages; i ++ )
+    {
+        pd_t *pd = &page_map[i];
+        pd->list = PAGE_LIST_NONE;
+        if(pd->huge == 1)
+        {
+            continue;
+        }
+        if(pd->allocated == 1 && pd->pte4 != NULL && (pd->pte4->present == 1 || pd->swapcache == 1))
+        {
+            list_push(numa_node_of(i), PAGE_LIST_INACTIVE, i);
+        }
+        else
+        {
+            pd->allocated = 0;
+            list_push(numa_node_of(i), PAGE_LIST_FREE, i);
+        }
+    }
+    built = 1;
+}
+
+void page_alloc_reset()
+{
+    built = 0;
+    memset(&stats, 0, sizeof(stats));
+}
+
+int64_t page_alloc(int node)
+{
+    build();
+    int64_t ppn = lists[node][PAGE_LIST_FREE].head;
+    if(ppn != NO_PAGE)
+    {
+        list_remove(ppn);
+        stats.alloc_count ++ ;
+    }
+    return ppn;
+}
+
+int page_is_free(uint64_t ppn)
+{
+    build();
+    return page_map[ppn].list == PAGE_LIST_FREE;
+}
+
+void page_take(uint64_t ppn)
+{
+    assert(page_is_free(ppn) == 1);
+    list_remove(ppn);
+    stats.alloc_count ++ ;
+}
+
+void page_lru_add(uint64_t ppn)
+{
+    build();
+    assert(page_map[ppn].list == PAGE_LIST_NONE);
+    list_push(numa_node_of(ppn), PAGE_LIST_INACTIVE, ppn);
+}
+
+void page_release(uint64_t ppn)
+{
+    build();
+    pd_t *pd = &page_map[ppn];
+    assert(pd->huge == 0);
+    if(pd->list != PAGE_LIST_NONE)
+    {
+        list_remove(ppn);
+    }
+    pd->allocated = 0;
+    pd->dirty = 0;
+    pd->swapcache = 0;
+    pd->pte4 = NULL;
+    list_push(numa_node_of(ppn), PAGE_LIST_FREE, ppn);
+}
+
+int64_t page_reclaim(int node, int (*referenced)(uint64_t ppn))
+{
+    build();
+    page_list_t *active = &lists[node][PAGE_LIST_ACTIVE];
+    page_list_t *inactive = &lists[node][PAGE_LIST_INACTIVE];
+
+    while(1)
+    {
+        // age the active list while it is the longer one
+        while(active->count > inactive->count)
+        {
+            uint64_t ppn = active->head;
+            list_remove(ppn);
+            if(referenced(ppn) == 1)
+            {
+                stats.rotate_count ++ ;
+                list_push(node, PAGE_LIST_ACTIVE, ppn);
+            }
+            else
+            {
+                stats.deactivate_count ++ ;
+                list_push(node, PAGE_LIST_INACTIVE, ppn);
+            }
+        }
+
+        if(inactive->count == 0)
+        {
+            return NO_PAGE;
+        }
+
+        uint64_t ppn = inactive->head;
+        list_remove(ppn);
+        stats.scan_count ++ ;
+        if(referenced(ppn) == 1)
+        {
+            // second chance
+            stats.activate_count ++ ;
+            list_push(node, PAGE_LIST_ACTIVE, ppn);
+            continue;
+        }
+
+        stats.reclaim_count ++ ;
+        return ppn;
+    }
+}
+
+page_alloc_stats_t *page_alloc_stats()
+{
+    return &stats;
+}
+
+void page_alloc_print(FILE *fw)
+{
+    build();
+    for(int i = 0; i < (numa_num_nodes > 1 ? numa_num_nodes : 1); i ++ )
+    {
+        fprintf(fw, "node %d free:%lu active:%lu inactive:%lu\n", i,
+            lists[i][PAGE_LIST_FREE].count, lists[i][PAGE_LIST_ACTIVE].count, lists[i][PAGE_LIST_INACTIVE].count);
+    }
+    fprintf(fw, "pages allocated:%lu reclaimed:%lu scanned:%lu activated:%lu deactivated:%lu rotated:%lu\n",
+        stats.alloc_count, stats.reclaim_count, stats.scan_count,
+        stats.activate_count, stats.deactivate_count, stats.rotate_count);
+}
@@ -0,0 +1,401 @@
+// memory profile: reuse distance, working set and hot lines of the DRAM access stream
+//
+// reuse distance (Mattson 1970, Bennett & Kruskal 1975): at the time t of an access to x,
+// the distance is the number of distinct addresses accessed since the last access to x at l.
+// each address keeps one mark in a Fenwick tree, at the time of its last access, so the
+// distance is the number of marks in (l, t): two prefix sums. the mark of x then moves from l
+// to t. the tree is indexed by time, and when the time reaches the end of the tree the marks
+// are renumbered 1..n in order, which keeps the tree as small as the number of addresses
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/address.h>
+#include <headers/memory.h>
+
+#define NIL (0xffffffff)
+
+// distance histograms have one bucket per power of 2: 0, 1, 2-3, 4-7, ...
+#define NUM_DISTANCE_BUCKETS (65)
+
+typedef struct
+{
+    uint64_t addr;          // line or page address
+    uint64_t last;          // time of the last access, the position of the mark
+    uint64_t count;         // accesses
+    uint64_t write_count;
+    uint64_t window;        // the last window which accessed the address
+} profile_entry_t;
+
+typedef struct
+{
+    int shift;              // line or page offset length
+
+    profile_entry_t *entries;
+    uint32_t num_entries;
+    uint32_t capacity;
+
+    uint32_t *table;        // open addressing: addr -> entry index
+    uint64_t table_size;    // power of 2
+
+    uint32_t *tree;         // Fenwick tree over times 1..tree_size - 1
+    uint64_t tree_size;
+    uint64_t time;          // time of the last access
+
+    uint64_t histogram[NUM_DISTANCE_BUCKETS];
+    uint64_t cold_count;    // first accesses, infinite distance
+
+    uint64_t window_count;  // distinct addresses of the current window
+} profile_level_t;
+
+typedef struct
+{
+    uint64_t lines;
+    uint64_t pages;
+} profile_window_t;
+
+int memory_profile_enabled = 0;
+
+static profile_level_t line_level;
+static profile_level_t page_level;
+
+static uint64_t window_length;
+static uint64_t num_accesses;
+static int num_top;
+
+static profile_window_t *windows;
+static uint64_t num_windows;
+static uint64_t windows_capacity;
+
+/*======================================*/
+/*      Fenwick tree                    */
+/*======================================*/
+
+static void tree_add(profile_level_t *lv, uint64_t i, int delta)
+{
+    for(; i < lv->tree_size; i += i & (-i))
+    {
+        lv->tree[i] += delta;
+    }
+}
+
+// marks at times 1..i
+static uint64_t tree_sum(profile_level_t *lv, uint64_t i)
+{
+    uint64_t sum = 0;
+    for(; i > 0; i -= i & (-i))
+    {
+        sum += lv->tree[i];
+    }
+    return sum;
+}
+
+static int compare_last(const void *a, const void *b)
+{
+    uint64_t x = (*(profile_entry_t **)a)->last;
+    uint64_t y = (*(profile_entry_t **)b)->last;
+    return x < y ? -1 : (x > y);
+}
+
+// renumber the marks 1..n keeping their order, the tree doubles if it would be half full
+static void tree_compact(profile_level_t *lv)
+{
+    profile_entry_t **order = malloc(lv->num_entries * sizeof(profile_entry_t *));
+    assert(order != NULL);
+    for(uint32_t i = 0; i < lv->num_entries; i ++ )
+    {
+        order[i] = &lv->entries[i];
+    }
+    qsort(order, lv->num_entries, sizeof(profile_entry_t *), compare_last);
+
+    while(2 * ((uint64_t)lv->num_entries + 1) > lv->tree_size)
+    {
+        lv->tree_size *= 2;
+    }
+    free(lv->tree);
+    lv->tree = calloc(lv->tree_size, sizeof(uint32_t));
+    assert(lv->tree != NULL);
+
+    for(uint32_t i = 0; i < lv->num_entries; i ++ )
+    {
+        order[i]->last = i + 1;
+        tree_add(lv, i + 1, 1);
+    }
+    lv->time = lv->num_entries;
+    free(order);
+}
+
+/*======================================*/
+/*      address table                   */
+/*======================================*/
+
+static inline uint64_t hash_addr(uint64_t addr, uint64_t table_size)
+{
+    return (addr * 0x9e3779b97f4a7c15ULL) >> (64 - __builtin_ctzll(table_size));
+}
+
+static void table_resize(profile_level_t *lv, uint64_t table_size)
+{
+    free(lv->table);
+    lv->table = malloc(table_size * sizeof(uint32_t));
+    assert(lv->table != NULL);
+    memset(lv->table, 0xff, table_size * sizeof(uint32_t));
+    lv->table_size = table_size;
+
+    for(uint32_t i = 0; i < lv->num_entries; i ++ )
+    {
+        uint64_t h = hash_addr(lv->entries[i].addr, table_size);
+        while(lv->table[h] != NIL)
+        {
+            h = (h + 1) & (table_size - 1);
+        }
+        lv->table[h] = i;
+    }
+}
+
+// the entry of addr, NULL if the address is accessed for the first time (then it's inserted)
+static profile_entry_t *find_or_insert(profile_level_t *lv, uint64_t addr)
+{
+    uint64_t h = hash_addr(addr, lv->table_size);
+    while(lv->table[h] != NIL)
+    {
+        if(lv->entries[lv->table[h]].addr == addr)
+        {
+            return &lv->entries[lv->table[h]];
+        }
+        h = (h + 1) & (lv->table_size - 1);
+    }
+
+    if(lv->num_entries == lv->capacity)
+    {
+        lv->capacity *= 2;
+        lv->entries = realloc(lv->entries, lv->capacity * sizeof(profile_entry_t));
+        assert(lv->entries != NULL);
+    }
+
+    uint32_t e = lv->num_entries ++ ;
+    memset(&lv->entries[e], 0, sizeof(profile_entry_t));
+    lv->entries[e].addr = addr;
+    lv->entries[e].window = ~0ULL;
+    lv->table[h] = e;
+
+    // keep the load factor under 1/2
+    if(2 * (uint64_t)lv->num_entries > lv->table_size)
+    {
+        table_resize(lv, lv->table_size * 2);
+    }
+    return NULL;
+}
+
+/*======================================*/
+/*      one granularity                 */
+/*======================================*/
+
+static void level_init(profile_level_t *lv, int shift)
+{
+    memset(lv, 0, sizeof(profile_level_t));
+    lv->shift = shift;
+
+    lv->capacity = 4096;
+    lv->entries = malloc(lv->capacity * sizeof(profile_entry_t));
+    assert(lv->entries != NULL);
+    table_resize(lv, 8192);
+
+    lv->tree_size = 1 << 16;
+    lv->tree = calloc(lv->tree_size, sizeof(uint32_t));
+    assert(lv->tree != NULL);
+}
+
+static void level_free(profile_level_t *lv)
+{
+    free(lv->entries);
+    free(lv->table);
+    free(lv->tree);
+    memset(lv, 0, sizeof(profile_level_t));
+}
+
+static void level_access(profile_level_t *lv, uint64_t paddr, int is_write, uint64_t window)
+{
+    if(lv->time + 1 == lv->tree_size)
+    {
+        tree_compact(lv);
+    }
+    uint64_t t = ++ lv->time;
+
+    uint64_t addr = paddr >> lv->shift;
+    profile_entry_t *x = find_or_insert(lv, addr);
+    if(x == NULL)
+    {
+        lv->cold_count ++ ;
+        // the entry has just been appended
+        x = &lv->entries[lv->num_entries - 1];
+    }
+    else
+    {
+        uint64_t distance = tree_sum(lv, t - 1) - tree_sum(lv, x->last);
+        int bucket = distance == 0 ? 0 : 64 - __builtin_clzll(distance);
+        lv->histogram[bucket] ++ ;
+        tree_add(lv, x->last, -1);
+    }
+    tree_add(lv, t, 1);
+    x->last = t;
+    x->count ++ ;
+    x->write_count += is_write != 0;
+
+    if(x->window != window)
+    {
+        x->window = window;
+        lv->window_count ++ ;
+    }
+}
+
+/*======================================*/
+/*      interface                       */
+/*======================================*/
+
+void memory_profile_enable(uint64_t window, int top)
+{
+    assert(window > 0 && top >= 0);
+    memory_profile_disable();
+
+    level_init(&line_level, SRAM_CACHE_OFFSET_LENGTH);
+    level_init(&page_level, PHYSICAL_PAGE_OFFSET_LENGTH);
+
+    window_length = window;
+    num_top = top;
+    num_accesses = 0;
+
+    windows_capacity = 64;
+    windows = malloc(windows_capacity * sizeof(profile_window_t));
+    assert(windows != NULL);
+    num_windows = 0;
+
+    memory_profile_enabled = 1;
+}
+
+void memory_profile_disable()
+{
+    if(memory_profile_enabled == 0)
+    {
+        return;
+    }
+    level_free(&line_level);
+    level_free(&page_level);
+    free(windows);
+    windows = NULL;
+    memory_profile_enabled = 0;
+}
+
+static void close_window()
+{
+    if(num_windows == windows_capacity)
+    {
+        windows_capacity *= 2;
+        windows = realloc(windows, windows_capacity * sizeof(profile_window_t));
+        assert(windows != NULL);
+    }
+    windows[num_windows].lines = line_level.window_count;
+    windows[num_windows].pages = page_level.window_count;
+    num_windows ++ ;
+
+    line_level.window_count = 0;
+    page_level.window_count = 0;
+}
+
+void memory_profile_access(uint64_t paddr, int is_write)
+{
+    uint64_t window = num_accesses / window_length;
+
+    level_access(&line_level, paddr, is_write, window);
+    level_access(&page_level, paddr, is_write, window);
+
+    num_accesses ++ ;
+    if(num_accesses % window_length == 0)
+    {
+        close_window();
+    }
+}
+
+static void write_histogram(FILE *fw, const char *granularity, profile_level_t *lv)
+{
+    for(int i = 0; i < NUM_DISTANCE_BUCKETS; i ++ )
+    {
+        if(lv->histogram[i] == 0)
+        {
+            continue;
+        }
+        uint64_t lo = i == 0 ? 0 : (uint64_t)1 << (i - 1);
+        uint64_t hi = i == 0 ? 0 : (i == 64 ? ~0ULL : ((uint64_t)1 << i) - 1);
+        fprintf(fw, "%s,%lu,%lu,%lu\n", granularity, lo, hi, lv->histogram[i]);
+    }
+    fprintf(fw, "%s,inf,inf,%lu\n", granularity, lv->cold_count);
+}
+
+static int compare_count(const void *a, const void *b)
+{
+    uint64_t x = (*(profile_entry_t **)a)->count;
+    uint64_t y = (*(profile_entry_t **)b)->count;
+    return x > y ? -1 : (x < y);
+}
+
+static FILE *open_csv(const char *prefix, const char *name)
+{
+    char path[4096];
+    snprintf(path, sizeof(path), "%s_%s.csv", prefix, name);
+    FILE *fw = fopen(path, "w");
+    if(fw == NULL)
+    {
+        printf("profile: can not open %s\n", path);
+        exit(0);
+    }
+    return fw;
+}
+
+void memory_profile_write_csv(const char *prefix)
+{
+    assert(memory_profile_enabled != 0);
+    FILE *fw;
+
+    fw = open_csv(prefix, "reuse");
+    fprintf(fw, "granularity,distance_min,distance_max,accesses\n");
+    write_histogram(fw, "line", &line_level);
+    write_histogram(fw, "page", &page_level);
+    fclose(fw);
+
+    fw = open_csv(prefix, "wss");
+    fprintf(fw, "window,first_access,lines,pages,bytes\n");
+    for(uint64_t i = 0; i < num_windows; i ++ )
+    {
+        fprintf(fw, "%lu,%lu,%lu,%lu,%lu\n", i, i * window_length,
+            windows[i].lines, windows[i].pages, windows[i].lines << SRAM_CACHE_OFFSET_LENGTH);
+    }
+    if(num_accesses % window_length != 0)
+    {
+        // the last window is partial
+        fprintf(fw, "%lu,%lu,%lu,%lu,%lu\n", num_windows, num_windows * window_length,
+            line_level.window_count, page_level.window_count,
+            line_level.window_count << SRAM_CACHE_OFFSET_LENGTH);
+    }
+    fclose(fw);
+
+    // the top lines by access count
+    profile_entry_t **order = malloc((line_level.num_entries + 1) * sizeof(profile_entry_t *));
+    assert(order != NULL);
+    for(uint32_t i = 0; i < line_level.num_entries; i ++ )
+    {
+        order[i] = &line_level.entries[i];
+    }
+    qsort(order, line_level.num_entries, sizeof(profile_entry_t *), compare_count);
+
+    fw = open_csv(prefix, "hot");
+    fprintf(fw, "rank,paddr,accesses,writes,share\n");
+    for(uint32_t i = 0; i < line_level.num_entries && i < num_top; i ++ )
+    {
+        fprintf(fw, "%u,0x%lx,%lu,%lu,%.6f\n", i + 1, order[i]->addr << SRAM_CACHE_OFFSET_LENGTH,
+            order[i]->count, order[i]->write_count, (double)order[i]->count / num_accesses);
+    }
+    fclose(fw);
+    free(order);
+}
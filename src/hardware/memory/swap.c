@@ -13,8 +13,15 @@
 然后把数据写入文件中。*/
 #define SWAP_PAGE_FILE_LINES 512
 
-// disk address counter
-//static uint64_t internal_swap_daddr = 0;
+// disk address counter: the swap slots are handed out once and never reused,
+// the slot 0 is no slot, the page was never swapped out
+static uint64_t internal_swap_daddr = 0;
+
+uint64_t swap_alloc()
+{
+    internal_swap_daddr ++ ;
+    return internal_swap_daddr;
+}
 
 int swap_in(uint64_t daddr, uint64_t ppn)
 {
@@ -25,13 +32,17 @@ int swap_in(uint64_t daddr, uint64_t ppn)
     assert(fr != NULL);
 
     uint64_t ppn_ppo =  ppn << PHYSICAL_PAGE_OFFSET_LENGTH;
+    uint64_t page[SWAP_PAGE_FILE_LINES];
     char buf[64] = {0};
     for(int i = 0; i < SWAP_PAGE_FILE_LINES; i ++ )
     { 
         char *str = fgets(buf, 64, fr);
-        *(uint64_t *)&(pm[ppn_ppo + i * 8]) = string2uint(str);
+        assert(str != NULL);
+        str[strcspn(str, "\n")] = '\0';
+        page[i] = string2uint(str);
     }
     fclose(fr);
+    dram_copy_to(ppn_ppo, page, sizeof(page));
 
     return 0;
 }
@@ -45,14 +56,12 @@ int swap_out(uint64_t daddr, uint64_t ppn)
     assert(fw != NULL);
 
     uint64_t ppn_ppo =  ppn << PHYSICAL_PAGE_OFFSET_LENGTH;
+    uint64_t page[SWAP_PAGE_FILE_LINES];
+    dram_copy_from(page, ppn_ppo, sizeof(page));
     for(int i = 0; i < SWAP_PAGE_FILE_LINES; i ++ )
     {
-        /* uint64 -> 8 byte -> 16 bit(hex) -> %16lx
-           因为 pm 是 uint8，所以我们要取得 pm 的地址将它转化成一个指针
-            然后通过给指针做类型转换(uint64_t *)就可以让这个指针以uint64的方式解引用
-            就可以得到一个 uint64 的值了
-        */        
-        fprintf(fw, "0x%16lx", *(uint64_t *)&(pm[ppn_ppo + i * 8]));
+        // uint64 -> 16 hex digits, one value per line, read back by fgets in swap_in
+        fprintf(fw, "0x%016lx\n", page[i]);
     }
     fclose(fw);
 
@@ -3,12 +3,12 @@
 
 #include <stdint.h>
 
-#define SRAM_CACHE_TAG_LENGTH    (4)
+#define SRAM_CACHE_TAG_LENGTH    (40)   // 52 - 6 - 6
 #define SRAM_CACHE_INDEX_LENGTH  (6)
 #define SRAM_CACHE_OFFSET_LENGTH (6)
 
-#define PHYSICAL_ADDRESS_LENGTH     (16)
-#define PHYSICAL_PAGE_NUMBER_LENGTH (4)     // 4 路组相连
+#define PHYSICAL_ADDRESS_LENGTH     (52)    // x86-64: at most 4 PB of physical memory
+#define PHYSICAL_PAGE_NUMBER_LENGTH (40)
 #define PHYSICAL_PAGE_OFFSET_LENGTH (12)
 
 #define VIRTUAL_ADDRESS_LENGTH     (48)
@@ -56,7 +56,7 @@ typedef union
         
     };
 
-    // sram cache: 48
+    // sram cache: 52 = 40 + 6 + 6, it splits the physical address
     struct 
     {
         uint64_t co : SRAM_CACHE_OFFSET_LENGTH;
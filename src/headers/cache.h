@@ -0,0 +1,251 @@
+#ifndef CACHE_GUARD
+#define CACHE_GUARD
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*======================================*/
+/*      SRAM cache model (sram.c)       */
+/*======================================*/
+
+typedef enum // cache 行中的状态信息
+{
+    CACHE_LINE_INVALID, // 设置为 invalid 更好判断
+    CACHE_LINE_CLEAN,   // In MESI: E, S
+    CACHE_LINE_DIRTY
+} sram_cacheline_state_t;
+
+// tag of invalid lines: no valid tag can be all ones since a tag has at most 64 - s - b bits
+#define SRAM_CACHE_TAG_INVALID (0xffffffffffffffffULL)
+
+// write policy, see the comment block of sram.c
+typedef enum
+{
+    SRAM_WRITE_BACK,        // write-back + write-allocate (default)
+    SRAM_WRITE_THROUGH,     // write-through + no-write-allocate: every store goes to DRAM
+    SRAM_WRITE_COMBINING,   // write-through + no-write-allocate, stores are coalesced in a write buffer
+} sram_write_policy_t;
+
+typedef struct
+{
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t eviction_count;    // valid lines replaced
+    uint64_t writeback_count;   // dirty lines written back to DRAM
+
+    // memory bus traffic caused by this cache, counted in tag-only mode as well
+    uint64_t dram_read_bytes;   // line fills
+    uint64_t dram_write_bytes;  // write-backs, write-throughs and write buffer drains
+    uint64_t dram_write_count;  // write transactions on the bus
+
+    uint64_t wbuf_merge_count;  // stores merged into a pending write buffer entry
+    uint64_t wbuf_full_count;   // stores which found the write buffer full
+} sram_cache_stats_t;
+
+// coalescing write buffer of SRAM_WRITE_COMBINING (sram_wbuf.c)
+typedef struct SRAM_WBUF_STRUCT sram_wbuf_t;
+
+// small fully associative LRU cache of the lines evicted from the cache (Jouppi 1990, sram_victim.c)
+// a miss which finds its line there swaps it back instead of reading DRAM
+typedef struct SRAM_VICTIM_STRUCT sram_victim_t;
+
+typedef struct
+{
+    uint64_t hit_count;         // misses of the cache served by the victim cache
+    uint64_t miss_count;        // misses of the cache which went to DRAM
+    uint64_t eviction_count;    // valid lines pushed out of the victim cache
+    uint64_t writeback_count;   // dirty lines written back to DRAM by the victim cache
+} sram_victim_stats_t;
+
+// way partitioning in the style of Intel CAT (sram_cat.c)
+// each requester (a core, a process or an address space) belongs to a class of service with a
+// mask of ways: a miss of the requester may only replace lines in the ways of its mask, while
+// hits are found in all ways. overlapping masks share ways, disjoint masks isolate the requesters
+#define SRAM_CACHE_MAX_REQUESTERS (16)  // 4 bits of requester id in binary traces
+
+typedef struct
+{
+    uint64_t way_mask;          // bit i: way i may be replaced by this requester
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t occupancy;         // valid lines filled by this requester
+    uint64_t evicted_count;     // lines of this requester replaced, by itself or by others
+} sram_requester_t;
+
+typedef struct
+{
+    int current;                // requester of the following accesses
+    uint8_t *owners;            // requester which filled each line
+    sram_requester_t requesters[SRAM_CACHE_MAX_REQUESTERS];
+} sram_partition_t;
+
+// miss status holding registers of the timing model (sram_mshr.c)
+// a miss allocates an MSHR until its line arrives, later misses to the same line merge into it,
+// and a miss which finds all MSHRs busy stalls the issue until the earliest one is free
+typedef struct SRAM_MSHR_STRUCT sram_mshr_t;
+
+typedef struct
+{
+    uint64_t cycles;            // completion of the last access
+    uint64_t primary_count;     // misses which allocated an MSHR
+    uint64_t secondary_count;   // accesses merged into the pending MSHR of their line
+    uint64_t full_count;        // misses which found all MSHRs busy
+    uint64_t stall_cycles;      // issue delayed by full MSHRs
+    uint64_t occupancy_cycles;  // sum over MSHRs of their busy cycles
+    uint64_t busy_cycles;       // cycles with at least one busy MSHR
+} sram_mshr_stats_t;            // memory level parallelism = occupancy_cycles / busy_cycles
+
+// 3C miss classification (Hill 1987), shadow structures in sram_3c.c:
+//  - compulsory: the line is touched for the first time
+//  - capacity:   the line also misses in a fully associative LRU cache of the same capacity
+//  - conflict:   the fully associative cache would hit, the set mapping made it miss
+typedef struct SRAM_SHADOW_STRUCT sram_shadow_t;
+
+typedef struct
+{
+    uint64_t compulsory_count;
+    uint64_t capacity_count;
+    uint64_t conflict_count;
+    uint64_t *conflict_per_set;     // heatmap of conflict misses, one counter per set
+} sram_3c_stats_t;
+
+// the geometry follows CSAPP cachelab: S = 2^s sets, E lines per set, B = 2^b bytes per block
+// the cache is stored as structure of arrays: the tags of one set are packed together so that a
+// probe reads E * 8 contiguous bytes and compares them with SIMD, instead of touching one host
+// cache line per way; line i of set ci is element (ci * E + i) of each array
+typedef struct // cache
+{
+    int index_length;       // s
+    int offset_length;      // b
+    int num_lines_per_set;  // E
+    uint64_t num_sets;      // S = 1 << s
+
+    uint64_t clock;         // increased by each access, used as LRU time
+    uint64_t *tags;         // SRAM_CACHE_TAG_INVALID for invalid lines
+    uint8_t *states;        // sram_cacheline_state_t
+    uint64_t *times;        // LRU stamp: the value of clock when last used, 0 for invalid lines
+    uint8_t *blocks;        // data of all lines, B bytes each, NULL in trace mode
+
+    sram_cache_stats_t stats;
+
+    sram_write_policy_t write_policy;
+    sram_wbuf_t *wbuf;          // NULL unless the policy is SRAM_WRITE_COMBINING
+
+    sram_mshr_t *mshr;          // NULL unless the timing model is enabled
+
+    sram_victim_t *victim;      // NULL unless the victim cache is enabled
+
+    sram_partition_t *partition;    // NULL unless way partitioning is enabled
+
+    sram_shadow_t *shadow;      // NULL unless the 3C classification is enabled
+} sram_cache_t;
+
+// result of one access
+typedef enum
+{
+    SRAM_CACHE_HIT,
+    SRAM_CACHE_MISS,            // filled an invalid line
+    SRAM_CACHE_MISS_EVICTION,   // replaced a valid line
+} sram_cache_result_t;
+
+// store_data == 0 builds a tag-only cache which never touches DRAM (used by trace driven simulation)
+sram_cache_t *sram_cache_construct(int index_length, int num_lines_per_set, int offset_length, int store_data);
+void sram_cache_free(sram_cache_t *cache);
+void sram_cache_reset_stats(sram_cache_t *cache);
+
+// probe the cache with one access of size bytes, the bytes beyond the line are ignored
+// read misses always allocate, write misses allocate only with SRAM_WRITE_BACK
+sram_cache_result_t sram_cache_access(sram_cache_t *cache, uint64_t paddr, int size, int is_write);
+
+// wbuf_entries is the depth of the write buffer of SRAM_WRITE_COMBINING (block size at most 64 bytes)
+// the cache is flushed before the policy is switched
+void sram_cache_set_write_policy(sram_cache_t *cache, sram_write_policy_t policy, int wbuf_entries);
+
+// drain the write buffer and write back all dirty lines, the lines stay valid and become clean
+void sram_cache_flush(sram_cache_t *cache);
+
+// the cache of the simulated cpu, used by sram_cache_read/sram_cache_write
+sram_cache_t *sram_cache_default();
+
+// timing model: an access hits after hit_latency cycles, a miss after hit_latency + miss_latency
+// *cycle is the cycle the access is ready to issue, and is returned as the cycle it issued:
+// the issue is in order and stalls while all MSHRs are busy. *done is the cycle the data is ready,
+// stores are done after hit_latency since nothing waits for them
+void sram_cache_enable_mshr(sram_cache_t *cache, int num_mshrs, uint64_t hit_latency, uint64_t miss_latency);
+void sram_cache_disable_mshr(sram_cache_t *cache);
+sram_cache_result_t sram_cache_access_at(sram_cache_t *cache, uint64_t paddr, int size, int is_write,
+    uint64_t *cycle, uint64_t *done);
+sram_mshr_stats_t *sram_cache_mshr_stats(sram_cache_t *cache);
+
+// victim cache of num_entries lines, disabling it writes back its dirty lines
+void sram_cache_enable_victim(sram_cache_t *cache, int num_entries);
+void sram_cache_disable_victim(sram_cache_t *cache);
+sram_victim_stats_t *sram_cache_victim_stats(sram_cache_t *cache);
+
+// way partitioning, enabled with all ways allowed to all requesters (at most 64 ways)
+// must be enabled before the first access for the occupancy to be exact
+void sram_cache_enable_partition(sram_cache_t *cache);
+void sram_cache_disable_partition(sram_cache_t *cache);
+void sram_cache_set_way_mask(sram_cache_t *cache, int requester, uint64_t way_mask);
+void sram_cache_set_requester(sram_cache_t *cache, int requester);
+void sram_cache_print_partition(sram_cache_t *cache, FILE *fw);
+
+// 3C classification, must be enabled before the first access to be exact
+void sram_cache_enable_3c(sram_cache_t *cache);
+void sram_cache_disable_3c(sram_cache_t *cache);
+sram_3c_stats_t *sram_cache_3c_stats(sram_cache_t *cache);
+void sram_cache_print_3c(sram_cache_t *cache, FILE *fw);
+
+// byte interface of the default cache of the simulated cpu
+uint8_t sram_cache_read(uint64_t paddr);
+void sram_cache_write(uint64_t paddr, uint8_t data);
+// write back and invalidate the lines of [paddr, paddr + size), called around the bulk transfers
+void sram_cache_flush_range(uint64_t paddr, uint64_t size);
+
+/*======================================*/
+/*      stack distance sweep            */
+/*======================================*/
+
+// Mattson's stack algorithm: LRU is a stack algorithm, a line hits in an E-way set iff
+// less than E other lines of the same set were used since its last use (its stack distance).
+// one pass over the trace gives the distance histogram of a set count, which answers
+// the hit count of every associativity of that set count at once
+typedef struct
+{
+    int offset_length;      // b, fixed for the whole sweep
+    int max_index_length;   // s = 0, 1, ..., max_index_length are swept
+    int max_ways;           // E = 1, 2, ..., max_ways are answered
+
+    uint64_t num_accesses;
+    // histograms[s][d]: accesses with stack distance d in the caches of 2^s sets
+    // d == max_ways counts the accesses which miss in all associativities (including cold misses)
+    uint64_t **histograms;
+} sram_sweep_t;
+
+sram_sweep_t *sram_sweep_construct(int offset_length, int max_index_length, int max_ways);
+void sram_sweep_free(sram_sweep_t *sweep);
+
+// paddrs are the accesses in order, the work is split by set index over num_threads host threads
+void sram_sweep_run(sram_sweep_t *sweep, const uint64_t *paddrs, uint64_t count, int num_threads);
+uint64_t sram_sweep_hit_count(sram_sweep_t *sweep, int index_length, int ways);
+
+// interface of I/O bus between SRAM cache and DRAM (dram.c)
+void bus_read_cacheline (uint64_t paddr, uint8_t *block);
+void bus_write_cacheline(uint64_t paddr, uint8_t *block);
+// partial writes of write-through caches: size bytes at paddr,
+// or the bytes of a cache block selected by the bit mask (bit i is byte i of the block)
+void bus_write_bytes (uint64_t paddr, const uint8_t *data, int size);
+void bus_write_masked(uint64_t paddr, const uint8_t *block, uint64_t mask);
+
+// bytes moved on the bus since the start of the simulation
+typedef struct
+{
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t read_count;
+    uint64_t write_count;
+} bus_traffic_t;
+
+extern bus_traffic_t bus_traffic;
+
+#endif
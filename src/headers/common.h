@@ -31,6 +31,12 @@
 // use SRAM Cache for Memory acces
 #define DEBUG_ENABLE_SRAM_CACHE     (0)
 
+// cache the translations of va2pa in the TLB, 0 for the software translation cache of
+// functional simulation (mmu.c), e.g. -DUSE_TLB_HARDWARE=0
+#ifndef USE_TLB_HARDWARE
+#define USE_TLB_HARDWARE            (1)
+#endif
+
 // print warpper
 uint64_t debug_print(uint64_t open_set, const char *format, ... );
 
@@ -1,6 +1,7 @@
 #ifndef CPU_GUARD
 #define CPU_GUARD
 
+#include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -157,7 +158,7 @@ typedef struct
         uint8_t  r15b;
     };
 } cpu_reg_t;
-cpu_reg_t cpu_reg;
+extern cpu_reg_t cpu_reg;
 
 
 /*===================================*/
@@ -219,7 +220,7 @@ typedef union {
         uint16_t OF;
     };
 } cpu_flags_t;
-cpu_flags_t cpu_flags;
+extern cpu_flags_t cpu_flags;
 
 // program count or instruction pointer
 typedef union
@@ -227,7 +228,7 @@ typedef union
     uint64_t rip;
     uint64_t eip;
 } cpu_pc_t;
-cpu_pc_t cpu_pc;
+extern cpu_pc_t cpu_pc;
 
 // control registers
 typedef struct 
@@ -239,7 +240,7 @@ typedef struct
                        but we are using 48-bit virtual address on simulator;s heap
                        by maloc() */
 } cpu_cr_t;
-cpu_cr_t cpu_controls;
+extern cpu_cr_t cpu_controls;
 
 // move to common.h to be shared by linker
 // #define MAX_INSTRUCTION_CHAR 64
@@ -253,13 +254,189 @@ void instruction_cycle();
 // place the functions here because they requires the core_t type
 
 
+/*----------------------------------*/
+// TLB (tlb.c): set associative cache of translations vpn -> ppn, LRU replacement
+
+#define TLB_VPN_INVALID     (0xffffffffffffffff)
+
+typedef struct
+{
+    uint64_t hit_count;
+    uint64_t miss_count;
+    uint64_t eviction_count;
+    uint64_t invalidate_count;  // single pages (INVLPG)
+    uint64_t flush_count;       // the whole TLB
+    uint64_t asid_flush_count;  // the entries of one address space
+} tlb_stats_t;
+
+typedef struct
+{
+    int index_length;       // 2^index_length sets
+    int num_ways;
+    uint64_t num_sets;
+
+    // entry i of set s is at s * num_ways + i
+    uint64_t *vpns;         // TLB_VPN_INVALID for invalid entries
+    uint64_t *ppns;
+    uint64_t *times;        // LRU stamp, 0 for invalid entries
+    int *asids;             // the address space of the entry
+    uint64_t clock;
+    int asid;               // of the lookups and fills
+
+    tlb_stats_t stats;
+} tlb_t;
+
+tlb_t *tlb_construct(int index_length, int num_ways);
+void tlb_free(tlb_t *tlb);
+
+// the entries are tagged with the current ASID of the TLB, 0 until set
+void tlb_set_asid(tlb_t *tlb, int asid);
+// 1 and the ppn on a hit, 0 on a miss
+int  tlb_lookup(tlb_t *tlb, uint64_t vpn, uint64_t *ppn);
+void tlb_insert(tlb_t *tlb, uint64_t vpn, uint64_t ppn);
+// vpn in the current ASID (INVLPG), or in all of them
+void tlb_invalidate(tlb_t *tlb, uint64_t vpn);
+void tlb_invalidate_all_asids(tlb_t *tlb, uint64_t vpn);
+// the entries of one ASID, or all the entries
+void tlb_flush_asid(tlb_t *tlb, int asid);
+void tlb_flush(tlb_t *tlb);
+void tlb_print(tlb_t *tlb, const char *name, FILE *fw);
+
+
 /*----------------------------------*/
 // mmu function
 
 
 // transllate the virtual addres to physical address in MMU
 // each MU is owned by each core
+// va2pa translates operands through the dTLB, va2pa_inst instruction fetch through the iTLB
 uint64_t va2pa(uint64_t vaddr);
+uint64_t va2pa_inst(uint64_t vaddr);
+
+// the TLBs of the MMU: split L1 TLBs backed by a unified second level TLB
+typedef enum
+{
+    MMU_ITLB,
+    MMU_DTLB,
+    MMU_STLB,
+    NUM_MMU_TLBS,
+} mmu_tlb_level_t;
+
+// the sizes of the pages, the huge pages are mapped by the pmd (2MB) and pud (1GB) entries
+typedef enum
+{
+    PAGE_4K,
+    PAGE_2M,
+    PAGE_1G,
+    NUM_PAGE_SIZES,
+} page_size_t;
+
+typedef struct
+{
+    uint64_t translation_count;
+    uint64_t lookup_counts[NUM_MMU_TLBS];
+    uint64_t hit_counts[NUM_MMU_TLBS];      // in any of the page sizes
+    uint64_t walk_count;        // missed all the TLBs
+    uint64_t walk_step_count;   // page table entries read by the walks
+    uint64_t walk_step_saved_count;     // the levels skipped thanks to the page walk cache
+    uint64_t cycles;            // the latencies of the TLB lookups and page walks
+    uint64_t cr3_write_count;
+    uint64_t flush_count;           // CR3 writes which flushed the TLBs, without ASIDs
+    uint64_t flush_avoided_count;   // CR3 writes which found the ASID of the address space
+    uint64_t asid_flush_count;      // ASIDs taken over from another address space, or flushed
+} mmu_stats_t;
+extern mmu_stats_t mmu_stats;
+
+// each level has one TLB per page size
+tlb_t *mmu_tlb(mmu_tlb_level_t level, page_size_t page_size);
+// latency is the cycles of a lookup of this level, all page sizes at once
+void mmu_tlb_configure(mmu_tlb_level_t level, page_size_t page_size, int index_length, int num_ways, uint64_t latency);
+// latency of one level of the page walk
+void mmu_set_walk_latency(uint64_t latency);
+
+// the page walk cache: the upper level entries of the page table, by virtual address prefix
+typedef enum
+{
+    MMU_PWC_PML4,       // pgd entries, skip 1 level
+    MMU_PWC_PDPT,       // pud entries, skip 2 levels
+    MMU_PWC_PDE,        // pmd entries, skip 3 levels
+    NUM_MMU_PWCS,
+} mmu_pwc_level_t;
+
+tlb_t *mmu_pwc(mmu_pwc_level_t level);
+void mmu_pwc_configure(mmu_pwc_level_t level, int index_length, int num_ways);
+void mmu_print(FILE *fw);
+// switch address space: CR3 is written, the TLB entries of the address space are found again
+// under its ASID if it still has one. CR3 0 is a new address space, its pgd made by the page walk
+void mmu_write_cr3(uint64_t cr3);
+// the number of ASIDs (default 6, at most 4096), 0 flushes the TLBs at each CR3 write.
+// the ASIDs are given again and the TLBs flushed
+void mmu_set_num_asids(int num_asids);
+int mmu_current_asid();
+// the TLB entries of one address space (INVPCID single context)
+void mmu_flush_asid(int asid);
+// the page table entry of vaddr changed in the current address space (INVLPG)
+void mmu_invalidate_page(uint64_t vaddr);
+
+// the cores, each with its own MMU: TLBs, page walk caches, ASIDs and CR3 (default 1).
+// they run one at a time, mmu_switch_core makes one the running core: its CR3 goes to
+// cpu_controls, the page table arena is up to the caller
+#define MMU_MAX_CORES       (64)    // a cpumask is 64 bits
+void mmu_set_num_cores(int num_cores);
+void mmu_switch_core(int core);
+int mmu_current_core();
+
+// TLB shootdown: the cores which may cache a page unmapped get an IPI to invalidate it
+typedef struct
+{
+    uint64_t request_count;     // pages unmapped and address spaces freed
+    uint64_t local_count;       // of them, in no other core
+    uint64_t batch_count;       // IPI rounds
+    uint64_t ipi_count;
+    uint64_t invalidate_count;  // pages invalidated by the IPIs
+    uint64_t flush_count;       // TLBs flushed whole by the IPIs, more pages than the ceiling
+    uint64_t initiator_cycles;  // local invalidations and waiting for the acknowledgements
+    uint64_t target_cycles;     // lost by the interrupted cores
+} mmu_shootdown_stats_t;
+extern mmu_shootdown_stats_t mmu_shootdown_stats;
+
+// the requests sent at once (default 32), 1 for no batching
+void mmu_set_shootdown_batch(int max_requests);
+// a core with more pages in a batch flushes its TLB (default 33)
+void mmu_set_shootdown_ceiling(int max_pages);
+// cycles of an IPI round trip, of an INVLPG and of a TLB flush
+void mmu_set_shootdown_latency(uint64_t ipi, uint64_t invlpg, uint64_t flush);
+// send the requests queued
+void mmu_shootdown_flush();
+// the loader asks for huge pages of page_size for [vaddr, vaddr + size) (like MAP_HUGETLB):
+// the faults of the region map the aligned huge pages inside it, when there are enough
+// contiguous free physical pages, and 4KB pages otherwise
+void mmu_request_huge_pages(uint64_t vaddr, uint64_t size, page_size_t page_size);
+
+// the page faults of the 4KB pages: a page swapped out is read back from its swap slot, a page
+// never swapped out is zeroed. readahead reads the next pages of the same page table swapped out
+// too, into the swap cache, in the same disk round trip: their faults are minor faults.
+// readahead takes free pages only and stops when there are none, it never reclaims.
+// fault-around maps the pages of the aligned window around a fault already in the swap cache
+typedef struct
+{
+    uint64_t fault_count;
+    uint64_t zero_fill_count;       // never swapped out
+    uint64_t major_count;           // read from the swap slot
+    uint64_t minor_count;           // found in the swap cache
+    uint64_t swap_in_count;         // disk round trips, with the readahead of the fault
+    uint64_t swap_out_count;
+    uint64_t readahead_count;       // pages read ahead into the swap cache
+    uint64_t readahead_hit_count;   // of them, mapped by a fault or fault-around
+    uint64_t readahead_miss_count;  // of them, evicted before
+    uint64_t fault_around_count;    // pages mapped around the faults
+} page_fault_stats_t;
+extern page_fault_stats_t page_fault_stats;
+
+// 0 (default) reads the faulting page only
+void mmu_set_swap_readahead(int num_pages);
+// the window in pages, 0 (default) maps the faulting page only
+void mmu_set_fault_around(int num_pages);
 
 
 // end of include guard
@@ -2,27 +2,29 @@
 #ifndef MEMORY_GUARD
 #define MEMORY_GUARD
 
+#include <stdio.h>
 #include <stdint.h>
 #include <headers/cpu.h>
+#include <headers/address.h>
 
 /*========================================*/
 /*      physical memory on dram chips     */
 /*========================================*/
 
 // physical momory space is decided by the physical address
-// in this simulator, there are 4 + 6 + 6 = 16 bits physical address
-// then the pyhsical space is (1 << 16) = 65536
-// total 16 physical memory
-#define PHYSICAL_MEMORY_SPACE    (65536)
-#define MAX_INDEX_PHYSICAL_PAGE  (15)
-#define MAX_NUM_PHYSICAL_PAGE    (16)   // 1 + MAX_INDEX_PHYSICAL_PAGE
+// the physical address has 40 + 12 = 52 bits, the size of the simulated memory is set at runtime
+// by physical_memory_init(), up to the memory the host can map; before that, the memory is
+// the default 16 physical pages (65536 bytes)
+#define PHYSICAL_MEMORY_DEFAULT_SIZE (65536)
+#define PHYSICAL_PAGE_SIZE           (1 << PHYSICAL_PAGE_OFFSET_LENGTH)
 
-#define PAGE_TABLE_ENTRY_NUM     (521)
+#define PAGE_TABLE_ENTRY_NUM     (512)
 
 // physical memory
-// 16 physical memory pages
 // only use for user process
-uint8_t pm[PHYSICAL_MEMORY_SPACE];
+extern uint8_t *pm;
+extern uint64_t pm_size;            // bytes
+extern uint64_t pm_num_pages;       // pm_size / PHYSICAL_PAGE_SIZE
 
 // page table entry struct(8 bytes)
 // 8 bytes = 64 bits
@@ -39,7 +41,7 @@ typedef union
         uint64_t cachedisabled  : 1;    // 是否可以将页放入 cache
         uint64_t reference      : 1;    
         uint64_t unused6        : 1;    // not use 6
-        uint64_t smallpage      : 1;    // page size, big for 4mb or small for 4kb
+        uint64_t pagesize       : 1;    // PS: 1 maps a huge page, 1GB in pud or 2MB in pmd, paddr is its first ppn
         uint64_t global         : 1;    
         uint64_t unused9_11     : 3;    // not use 9,10,11
         /*原本：
@@ -104,20 +106,83 @@ typedef struct
     // three state
     int allocated;   // 1 means have allocated
     int dirty;       // 1 means dirty value
-    int time;        // LRU cache
+    int huge;        // a page of a huge page: pinned, never swapped (like hugetlbfs), pte4 is NULL
+    pte123_t *huge_pte;     // the pmd or pud entry of the huge page, to release it with its address space
+
+    // the list of the page allocator (page_alloc.c) the page is on, linked by ppn
+    int list;
+    int64_t prev;
+    int64_t next;
 
     pte4_t *pte4;    // the reversed mapping: from PPN to page table entry
+    uint64_t vpn;    // and the virtual page of that entry, to invalidate its TLB entry
     // really world: mapping to anno_vma or address_space
     // we simply the situation here
     // TODO: if mutiple process are using this page e.g. shared library
     /* 反向映射并不是直接由物理地址映射到page table，它需要间接通过addresss_space */
     uint64_t daddr;   // disk address, binding the reverse mapping with mapping to disl
+    int swapcache;    // read ahead from daddr and not mapped yet: pte4 is the entry still swapped out
+    uint64_t cpumask; // the cores which may cache the translation of the page (TLB shootdown)
 } pd_t; // page descriptor
 
  // for each pagable (mappable) physical page, create one mapping
  // create one reversed mapping
  /* 这里的反向映射显然太浪费空间了，明显可以优化，但是我们没有.. */
-pd_t page_map[MAX_NUM_PHYSICAL_PAGE];  // 反向映射表 ppn->pt
+extern pd_t *page_map;  // 反向映射表 ppn->pt, pm_num_pages entries
+
+// the page tables (pgtable.c): taken by the page walk on demand, zeroed, from the arena of
+// the current address space
+typedef enum
+{
+    PAGE_TABLE_PGD,
+    PAGE_TABLE_PUD,
+    PAGE_TABLE_PMD,
+    PAGE_TABLE_PT,
+    NUM_PAGE_TABLE_LEVELS,
+} page_table_level_t;
+
+typedef struct
+{
+    uint64_t table_counts[NUM_PAGE_TABLE_LEVELS];   // the tables in use
+    uint64_t used_bytes;        // by the tables in use
+    uint64_t reserved_bytes;    // by the chunks of the arena
+    uint64_t chunk_count;
+} page_table_stats_t;
+
+typedef struct PAGE_TABLE_ARENA_STRUCT page_table_arena_t;
+
+page_table_arena_t *page_table_arena_construct();
+// all the tables of the arena at once
+void page_table_arena_free(page_table_arena_t *a);
+// the arena of the address space in CR3, NULL for the default one
+void page_table_arena_switch(page_table_arena_t *a);
+page_table_arena_t *page_table_arena_current();
+page_table_arena_t *page_table_arena_of(void *table);
+// 1 if the address is in a chunk of the arena, any address: in O(chunks)
+int page_table_arena_contains(page_table_arena_t *a, void *table);
+
+void *page_table_alloc(page_table_level_t level);
+void page_table_free(void *table, page_table_level_t level);
+// NULL for the current arena
+page_table_stats_t *page_table_stats(page_table_arena_t *a);
+void page_table_print(FILE *fw);
+// tear down an address space: its pages back to the free lists, its tables with the arena (mmu.c)
+void mmu_free_address_space(page_table_arena_t *a);
+
+// map size bytes (a multiple of the page size) of simulated physical memory. the host commits
+// the pages of pm and page_map lazily on first touch, so GBs of memory cost only what is used.
+// the contents of the previous memory are dropped, exit if the host refuses the mapping.
+// the translations keep frames of the previous memory: call it before the first translation,
+// or after mmu_free_address_space() of all address spaces (asserted: no page is allocated)
+void physical_memory_init(uint64_t size);
+void physical_memory_free();
+
+// map size bytes of physical memory from a memory image file instead of copying it in.
+// shared != 0: MAP_SHARED, the stores go to the file, which is created or extended as needed.
+// shared == 0: MAP_PRIVATE, the file is a read-only base image and the stores are copy-on-write
+void physical_memory_map_file(const char *filename, uint64_t size, int shared);
+// msync a shared memory image, no-op otherwise
+void physical_memory_sync();
 
 
 
@@ -138,5 +203,188 @@ void cpu_writeinst_dram(uint64_t paddr, const char *str);
 /*  but we nedd to write to the memory code area, so this function is set         */
 /*================================================================================*/
 
+// bulk transfer between the host and the simulated memory, for loaders, swap and DMA style copies.
+// they go to DRAM directly, after writing back and invalidating the lines of the range in the SRAM cache
+void dram_copy_to  (uint64_t paddr, const void *src, uint64_t size);
+void dram_copy_from(void *dst, uint64_t paddr, uint64_t size);
+void dram_set      (uint64_t paddr, uint8_t value, uint64_t size);
+
+// the same at a virtual address of the current address space: one va2pa per page touched (mmu.c)
+void va_copy_to  (uint64_t vaddr, const void *src, uint64_t size);
+void va_copy_from(void *dst, uint64_t vaddr, uint64_t size);
+// the 64 bits loads and stores of the instructions (mmu.c)
+uint64_t va_read64(uint64_t vaddr);
+void va_write64(uint64_t vaddr, uint64_t data);
+void va_set      (uint64_t vaddr, uint8_t value, uint64_t size);
+
+
+/*============================*/
+/*      memory profile        */
+/*============================*/
+
+// analysis of the data accesses of cpu_read64bits_dram/cpu_write64bits_dram (profile.c):
+//  - reuse distance histograms at cache line and page granularity: the number of distinct
+//    lines (pages) touched between two accesses to the same line (page). a fully associative
+//    LRU cache of C lines hits exactly the accesses of distance < C
+//  - working set size (distinct lines and pages) of each window of accesses
+//  - the hottest lines
+// each access costs O(log n) with a Fenwick tree over the access times
+extern int memory_profile_enabled;
+
+// window: accesses per working set window, top: number of hot lines reported
+void memory_profile_enable(uint64_t window, int top);
+void memory_profile_disable();
+void memory_profile_access(uint64_t paddr, int is_write);
+
+// prefix_reuse.csv, prefix_wss.csv and prefix_hot.csv
+void memory_profile_write_csv(const char *prefix);
+
+
+/*============================*/
+/*      DRAM timing           */
+/*============================*/
+
+// banks, rows and row buffers behind the bus (dram_timing.c): when enabled, every bus transfer
+// is a request to the memory controller at dram_timing_clock, and a read sets dram_timing_ready
+// to the cycle its data arrives. all latencies are in cycles of the requester
+typedef enum
+{
+    DRAM_OPEN_PAGE,         // the row stays open after the access
+    DRAM_CLOSED_PAGE,       // the bank is precharged after every access
+} dram_page_policy_t;
+
+typedef struct
+{
+    int channels;           // channels, ranks and banks are powers of 2
+    int ranks;              // per channel
+    int banks;              // per rank
+    uint64_t row_size;      // bytes of one row of a bank, a power of 2
+
+    uint64_t tRCD;          // activate: row to column delay
+    uint64_t tCAS;          // column access to data
+    uint64_t tRP;           // precharge
+    uint64_t tBURST;        // one line on the data bus
+
+    dram_page_policy_t page_policy;
+    int queue_size;         // the requests the FR-FCFS scheduler chooses from
+} dram_timing_config_t;
+
+typedef struct
+{
+    uint64_t read_count;
+    uint64_t write_count;
+    uint64_t row_hit_count;         // the row was open
+    uint64_t row_empty_count;       // the bank was precharged
+    uint64_t row_conflict_count;    // another row was open
+    uint64_t reordered_count;       // issued before an older request of the same bank
+    uint64_t read_latency_cycles;   // arrival to the end of the data of all reads
+} dram_timing_stats_t;
+
+extern int dram_timing_enabled;
+extern uint64_t dram_timing_clock;  // set by the requester before a transfer
+extern uint64_t dram_timing_ready;  // data of the last read
+
+// a DDR4-2400 like memory of 2 channels of 16 banks, open-page, the config of NULL
+const dram_timing_config_t *dram_timing_default_config();
+void dram_timing_enable(const dram_timing_config_t *config);
+void dram_timing_disable();
+// called by the bus: the cycle the data of a read arrives, writes are posted and return at once
+uint64_t dram_timing_request(uint64_t paddr, int is_write);
+// issue the posted writes still queued
+void dram_timing_drain();
+dram_timing_stats_t *dram_timing_stats();
+void dram_timing_print(FILE *fw);
+
+
+/*============================*/
+/*      NUMA                  */
+/*============================*/
+
+// the physical pages in nodes of distinct latency (numa.c). numa_init() after
+// physical_memory_init(), before it the memory is one node (UMA) and nothing is counted
+#define NUMA_MAX_NODES (8)
+
+typedef enum
+{
+    NUMA_FIRST_TOUCH,       // the node of the core which faults the page in
+    NUMA_INTERLEAVE,        // round robin over the nodes by virtual page number
+    NUMA_BIND,              // one node only
+} numa_policy_t;
+
+typedef struct
+{
+    uint64_t first_page;    // the ppns [first_page, first_page + num_pages)
+    uint64_t num_pages;
+    uint64_t latencies[NUMA_MAX_NODES];     // from this node to the memory of node j
+
+    // the memory of this node
+    uint64_t allocated_count;   // pages given by the page fault handler
+    uint64_t local_count;       // accessed by the core of this node
+    uint64_t remote_count;      // accessed by the core of another node
+    uint64_t cycles;            // the latencies of all those accesses
+} numa_node_t;
+
+extern int numa_num_nodes;
+extern int numa_current_node;       // the node the core runs on
+extern numa_node_t numa_nodes[NUMA_MAX_NODES];
+
+// equal nodes, local_latency on the diagonal of the latencies and remote_latency elsewhere
+void numa_init(int num_nodes, uint64_t local_latency, uint64_t remote_latency);
+void numa_set_latency(int from, int to, uint64_t latency);
+// node is the bound node of NUMA_BIND
+void numa_set_policy(numa_policy_t policy, int node);
+int numa_node_of(uint64_t ppn);
+
+// called by the page fault handler (mmu.c): the nodes to take a free page from, in order,
+// and whether the page may be replaced to make room
+int numa_fault_nodes(uint64_t vaddr, int *nodes);
+int numa_page_allowed(uint64_t ppn);
+void numa_page_allocated(uint64_t ppn);
+// called by the bus: count the access of the core to paddr, return its latency
+uint64_t numa_access(uint64_t paddr);
+void numa_print(FILE *fw);
+
+/*======================================*/
+/*      physical page allocator         */
+/*======================================*/
+
+// page_alloc.c: per NUMA node, the free pages and the active and inactive lists of the
+// mapped pages, evicted by CLOCK on their reference bits
+typedef enum
+{
+    PAGE_LIST_NONE,     // taken off the lists: being mapped, or pinned
+    PAGE_LIST_FREE,
+    PAGE_LIST_ACTIVE,
+    PAGE_LIST_INACTIVE,
+    NUM_PAGE_LISTS,
+} page_list_type_t;
+
+typedef struct
+{
+    uint64_t alloc_count;       // free pages given
+    uint64_t reclaim_count;     // victims given
+    uint64_t scan_count;        // inactive pages looked at
+    uint64_t activate_count;    // inactive pages referenced: to the active list
+    uint64_t deactivate_count;  // active pages not referenced: to the inactive list
+    uint64_t rotate_count;      // active pages referenced: stay active
+} page_alloc_stats_t;
+
+// forget the lists, they are built again from page_map on next use (pm or NUMA changed)
+void page_alloc_reset();
+// a free page of node off the free list, -1 when there is none
+int64_t page_alloc(int node);
+// the huge pages take given free pages
+int page_is_free(uint64_t ppn);
+void page_take(uint64_t ppn);
+// the page is mapped now: to the tail of the inactive list
+void page_lru_add(uint64_t ppn);
+// the page is not mapped anymore: back to the free list
+void page_release(uint64_t ppn);
+// the victim of node, off the lists, -1 when node has no mapped page. referenced tests and
+// clears the reference bit of a page
+int64_t page_reclaim(int node, int (*referenced)(uint64_t ppn));
+page_alloc_stats_t *page_alloc_stats();
+void page_alloc_print(FILE *fw);
+
 
 #endif
\ No newline at end of file
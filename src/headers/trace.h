@@ -0,0 +1,80 @@
+#ifndef TRACE_GUARD
+#define TRACE_GUARD
+
+#include <stdio.h>
+#include <stdint.h>
+
+/*======================================*/
+/*      memory access traces            */
+/*======================================*/
+
+/* Two formats are accepted, the format is detected by the magic of binary traces
+
+1. valgrind lackey text (the format of CSAPP cachelab traces), one access per line:
+    I  0400d7d4,8
+     S 7ff000398,8
+     L 04f6b868,8
+     M 0421c7f0,4
+   lines of other kinds (e.g. the "==pid==" banner of valgrind) are skipped
+
+2. compact binary: 8 bytes magic "JYTRACE1" followed by little-endian uint64_t records
+    +--------+--------+--------+--------------------+
+    | 63..60 | 59..56 | 55..48 |       47..0        |
+    +--------+--------+--------+--------------------+
+    |  req   |   op   |  size  |      address       |
+    +--------+--------+--------+--------------------+
+   req is the requester (core, process or address space) which made the access,
+   text traces have requester 0
+*/
+
+#define TRACE_BINARY_MAGIC      "JYTRACE1"
+#define TRACE_BINARY_MAGIC_SIZE (8)
+
+#define TRACE_ADDRESS_LENGTH    (48)
+#define TRACE_MAX_REQUESTERS    (16)
+
+typedef enum
+{
+    TRACE_OP_INST,      // I: instruction fetch
+    TRACE_OP_LOAD,      // L: data load
+    TRACE_OP_STORE,     // S: data store
+    TRACE_OP_MODIFY,    // M: data load followed by store to the same address
+} trace_op_t;
+
+typedef enum
+{
+    TRACE_FORMAT_LACKEY,
+    TRACE_FORMAT_BINARY,
+} trace_format_t;
+
+typedef struct
+{
+    uint64_t addr;
+    uint8_t size;
+    uint8_t op;     // trace_op_t
+    uint8_t requester;
+} trace_record_t;
+
+typedef struct
+{
+    trace_format_t format;
+    int fd;
+    const char *base;   // the whole file mapped read-only
+    uint64_t length;
+    uint64_t pos;       // next byte to parse
+    uint64_t line;      // current line number of text traces, for error messages
+} trace_t;
+
+// the file is mapped by mmap, exit on any error
+trace_t *trace_open(const char *filename);
+void trace_close(trace_t *trace);
+void trace_rewind(trace_t *trace);
+
+// parse at most max records into records, return the count, 0 means the end of trace
+uint64_t trace_read(trace_t *trace, trace_record_t *records, uint64_t max);
+
+// binary trace writer
+void trace_write_binary_header(FILE *fw);
+void trace_write_binary(FILE *fw, const trace_record_t *records, uint64_t count);
+
+#endif
@@ -0,0 +1,478 @@
+// trace driven cache simulator
+// stream a memory trace through the SRAM cache model (sram.c) and count hits, misses and evictions
+// the command line and the summary follow CSAPP cachelab csim, so the LRU can be checked
+// against csim-ref with the traces of cachelab or any valgrind lackey trace:
+//     valgrind --log-fd=1 --tool=lackey -v --trace-mem=yes ls -l > ls.trace
+// with -c, every miss is classified as compulsory, capacity or conflict (sram_3c.c)
+// with -S, all caches of 1..2^s sets and 1..E ways are answered by one pass (sram_sweep.c)
+// with -W, the write policy is selected and the bytes moved to and from DRAM are reported
+// with -T, the accesses are timed with MSHRs (sram_mshr.c), one access is issued per cycle,
+// or with -D each access waits for the data of the previous one (pointer chasing),
+// and with -R the memory latency comes from a model of DRAM banks and rows (dram_timing.c)
+// with -V, a victim cache (sram_victim.c) of the given number of lines is put behind the cache
+// with several -t, the traces run together as requesters 0, 1, ... (64 records of each in turn),
+// and -P gives a requester a mask of ways (sram_cat.c); the requesters are reported one by one
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <unistd.h>
+#include <headers/cache.h>
+#include <headers/memory.h>
+#include <headers/trace.h>
+
+#define TRACE_BATCH_SIZE (4096)
+
+static void usage(const char *argv0)
+{
+    printf("Usage: %s [-hvcS] -s <s> -E <E> -b <b> -t <tracefile> [-w <binary trace>] [-j <threads>]\n", argv0);
+    printf("       [-W <wb|wt|wc>] [-B <entries>] [-T <hit>,<miss>] [-M <mshrs>] [-D] [-R <open|closed>]\n");
+    printf("       [-V <lines>] [-t <tracefile> ...] [-P <requester>:<way mask>]\n");
+    printf("Options:\n");
+    printf("  -h         Print this help message.\n");
+    printf("  -v         Optional verbose flag.\n");
+    printf("  -s <num>   Number of set index bits.\n");
+    printf("  -E <num>   Number of lines per set.\n");
+    printf("  -b <num>   Number of block offset bits.\n");
+    printf("  -t <file>  Trace file, valgrind lackey text or binary.\n");
+    printf("             Several traces are interleaved, trace i is requester i.\n");
+    printf("  -w <file>  Also write the trace in the compact binary format.\n");
+    printf("  -c         Classify misses (3C) and print the conflict heatmap of sets.\n");
+    printf("  -S         Sweep: report the caches of 2^0..2^s sets and 1..E ways as CSV.\n");
+    printf("  -j <num>   Host threads used by the sweep.\n");
+    printf("  -W <name>  Write policy: wb write-back (default), wt write-through,\n");
+    printf("             wc write-through with a write combining buffer. Reports DRAM traffic.\n");
+    printf("  -B <num>   Entries of the write combining buffer (default 8).\n");
+    printf("  -T <h>,<m> Time the accesses: hit latency and memory latency in cycles.\n");
+    printf("  -M <num>   MSHRs of the timing model (default 8), 1 is a blocking cache.\n");
+    printf("  -D         Dependent accesses: each one waits for the data of the previous one.\n");
+    printf("  -R <name>  Time the memory by DRAM banks and rows instead of the -T memory latency,\n");
+    printf("             with the open or closed row buffer policy.\n");
+    printf("  -V <num>   Lines of a fully associative victim cache behind the cache.\n");
+    printf("  -P <r>:<m> Requester r may only replace the ways of the hex mask m.\n");
+    printf("\nExamples:\n");
+    printf("  linux>  %s -s 4 -E 1 -b 4 -t traces/yi.trace\n", argv0);
+    printf("  linux>  %s -v -s 8 -E 2 -b 4 -t traces/yi.trace\n", argv0);
+    printf("  linux>  %s -S -j 4 -s 12 -E 16 -b 6 -t traces/long.trace\n", argv0);
+    printf("  linux>  %s -W wc -B 4 -s 6 -E 8 -b 6 -t traces/memset.trace\n", argv0);
+    printf("  linux>  %s -T 4,200 -M 10 -s 6 -E 8 -b 6 -t traces/stream.trace\n", argv0);
+    printf("  linux>  %s -T 4,0 -R open -s 6 -E 8 -b 6 -t traces/stream.trace\n", argv0);
+    printf("  linux>  %s -c -V 8 -s 6 -E 1 -b 6 -t traces/trans.trace\n", argv0);
+    printf("  linux>  %s -P 0:0f -P 1:f0 -s 6 -E 8 -b 6 -t app.trace -t noisy.trace\n", argv0);
+}
+
+// the trace as the sequence of data accesses, M is a load and a store
+static uint64_t *load_accesses(trace_t *trace, uint64_t *num_accesses)
+{
+    static trace_record_t records[TRACE_BATCH_SIZE];
+    uint64_t count, n = 0, capacity = 1 << 20;
+
+    uint64_t *paddrs = malloc(capacity * sizeof(uint64_t));
+    assert(paddrs != NULL);
+
+    while((count = trace_read(trace, records, TRACE_BATCH_SIZE)) > 0)
+    {
+        if(n + 2 * count > capacity)
+        {
+            capacity = 2 * (n + 2 * count);
+            paddrs = realloc(paddrs, capacity * sizeof(uint64_t));
+            assert(paddrs != NULL);
+        }
+        for(uint64_t i = 0; i < count; i ++ )
+        {
+            trace_record_t *r = &records[i];
+            if(r->op == TRACE_OP_INST)
+            {
+                continue;
+            }
+            paddrs[n ++ ] = r->addr;
+            if(r->op == TRACE_OP_MODIFY)
+            {
+                paddrs[n ++ ] = r->addr;
+            }
+        }
+    }
+
+    *num_accesses = n;
+    return paddrs;
+}
+
+static void sweep(trace_t *trace, int s, int E, int b, int num_threads)
+{
+    uint64_t num_accesses;
+    uint64_t *paddrs = load_accesses(trace, &num_accesses);
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    sram_sweep_t *sw = sram_sweep_construct(b, s, E);
+    sram_sweep_run(sw, paddrs, num_accesses, num_threads);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+    printf("sets,ways,block,capacity,hits,misses,miss_ratio\n");
+    for(int i = 0; i <= s; i ++ )
+    {
+        for(int ways = 1; ways <= E; ways ++ )
+        {
+            uint64_t hits = sram_sweep_hit_count(sw, i, ways);
+            uint64_t misses = num_accesses - hits;
+            printf("%lu,%d,%lu,%lu,%lu,%lu,%.6f\n",
+                (uint64_t)1 << i, ways, (uint64_t)1 << b, ((uint64_t)ways << i) << b,
+                hits, misses, num_accesses > 0 ? (double)misses / num_accesses : 0.0);
+        }
+    }
+    fprintf(stderr, "%lu accesses x %d set counts in %.3f s\n", num_accesses, s + 1, seconds);
+
+    sram_sweep_free(sw);
+    free(paddrs);
+}
+
+static const char *result_name[] = {
+    [SRAM_CACHE_HIT]            = " hit",
+    [SRAM_CACHE_MISS]           = " miss",
+    [SRAM_CACHE_MISS_EVICTION]  = " miss eviction",
+};
+
+// the next batch of records: with several traces, TRACE_INTERLEAVE records of each in turn,
+// tagged with the index of their trace as requester
+#define TRACE_INTERLEAVE (64)
+
+static uint64_t read_batch(trace_t **traces, int num_traces, trace_record_t *records)
+{
+    if(num_traces == 1)
+    {
+        return trace_read(traces[0], records, TRACE_BATCH_SIZE);
+    }
+
+    uint64_t count = 0;
+    while(count + num_traces * TRACE_INTERLEAVE <= TRACE_BATCH_SIZE)
+    {
+        int live = 0;
+        for(int i = 0; i < num_traces; i ++ )
+        {
+            uint64_t n = trace_read(traces[i], &records[count], TRACE_INTERLEAVE);
+            for(uint64_t k = 0; k < n; k ++ )
+            {
+                records[count + k].requester = i;
+            }
+            count += n;
+            live += n > 0;
+        }
+        if(live == 0)
+        {
+            break;
+        }
+    }
+    return count;
+}
+
+// timing of the accesses (-T), the next access is ready to issue at next_issue
+static int timed = 0, dependent = 0;
+static uint64_t next_issue = 0;
+
+static sram_cache_result_t simulate(sram_cache_t *cache, uint64_t paddr, int size, int is_write)
+{
+    if(timed == 0)
+    {
+        return sram_cache_access(cache, paddr, size, is_write);
+    }
+
+    uint64_t cycle = next_issue, done;
+    sram_cache_result_t res = sram_cache_access_at(cache, paddr, size, is_write, &cycle, &done);
+    next_issue = (dependent != 0 && done > cycle + 1) ? done : cycle + 1;
+    return res;
+}
+
+static const char *write_policy_name[] = {
+    [SRAM_WRITE_BACK]      = "wb",
+    [SRAM_WRITE_THROUGH]   = "wt",
+    [SRAM_WRITE_COMBINING] = "wc",
+};
+
+static const char trace_op_name[] = {
+    [TRACE_OP_INST]   = 'I',
+    [TRACE_OP_LOAD]   = 'L',
+    [TRACE_OP_STORE]  = 'S',
+    [TRACE_OP_MODIFY] = 'M',
+};
+
+int main(int argc, char **argv)
+{
+    int s = -1, E = -1, b = -1, verbose = 0, classify = 0, sweep_mode = 0, num_threads = 1;
+    int write_policy = -1, wbuf_entries = 8, num_mshrs = 8, victim_lines = 0;
+    uint64_t hit_latency = 0, miss_latency = 0;
+    char *trace_files[TRACE_MAX_REQUESTERS], *binary_file = NULL;
+    int num_traces = 0, partition = 0, dram_policy = -1;
+    uint64_t way_masks[TRACE_MAX_REQUESTERS];
+
+    int opt;
+    while((opt = getopt(argc, argv, "hvcSDs:E:b:t:w:j:W:B:T:M:V:P:R:")) != -1)
+    {
+        switch(opt)
+        {
+            case 'v': verbose = 1; break;
+            case 's': s = atoi(optarg); break;
+            case 'E': E = atoi(optarg); break;
+            case 'b': b = atoi(optarg); break;
+            case 't':
+                if(num_traces == TRACE_MAX_REQUESTERS)
+                {
+                    printf("%s: at most %d traces\n", argv[0], TRACE_MAX_REQUESTERS);
+                    return 1;
+                }
+                trace_files[num_traces ++ ] = optarg;
+                break;
+            case 'w': binary_file = optarg; break;
+            case 'c': classify = 1; break;
+            case 'S': sweep_mode = 1; break;
+            case 'j': num_threads = atoi(optarg); break;
+            case 'W':
+                for(int i = 0; i < sizeof(write_policy_name) / sizeof(char *); i ++ )
+                {
+                    if(strcmp(optarg, write_policy_name[i]) == 0)
+                    {
+                        write_policy = i;
+                    }
+                }
+                if(write_policy < 0)
+                {
+                    printf("%s: unknown write policy %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'B': wbuf_entries = atoi(optarg); break;
+            case 'T':
+                if(sscanf(optarg, "%lu,%lu", &hit_latency, &miss_latency) != 2)
+                {
+                    printf("%s: -T takes <hit latency>,<memory latency>\n", argv[0]);
+                    return 1;
+                }
+                timed = 1;
+                break;
+            case 'M': num_mshrs = atoi(optarg); break;
+            case 'D': dependent = 1; break;
+            case 'V': victim_lines = atoi(optarg); break;
+            case 'R':
+                if(strcmp(optarg, "open") == 0)
+                {
+                    dram_policy = DRAM_OPEN_PAGE;
+                }
+                else if(strcmp(optarg, "closed") == 0)
+                {
+                    dram_policy = DRAM_CLOSED_PAGE;
+                }
+                else
+                {
+                    printf("%s: unknown row buffer policy %s\n", argv[0], optarg);
+                    return 1;
+                }
+                break;
+            case 'P':
+            {
+                int r;
+                uint64_t mask;
+                if(partition == 0)
+                {
+                    // requesters without -P may use all ways
+                    memset(way_masks, 0xff, sizeof(way_masks));
+                    partition = 1;
+                }
+                if(sscanf(optarg, "%d:%lx", &r, &mask) != 2 || r < 0 || r >= TRACE_MAX_REQUESTERS)
+                {
+                    printf("%s: -P takes <requester>:<hex way mask>, requester below %d\n", argv[0], TRACE_MAX_REQUESTERS);
+                    return 1;
+                }
+                way_masks[r] = mask;
+                break;
+            }
+            case 'h': usage(argv[0]); return 0;
+            default:  usage(argv[0]); return 1;
+        }
+    }
+
+    if(s < 0 || E <= 0 || b < 0 || s + b > 63 || wbuf_entries <= 0 || num_mshrs <= 0 || victim_lines < 0 || num_traces == 0)
+    {
+        printf("%s: Missing required command line argument\n", argv[0]);
+        usage(argv[0]);
+        return 1;
+    }
+    if(dram_policy >= 0 && timed == 0)
+    {
+        printf("%s: the DRAM model (-R) times the accesses of -T\n", argv[0]);
+        return 1;
+    }
+
+    trace_t *traces[TRACE_MAX_REQUESTERS];
+    for(int i = 0; i < num_traces; i ++ )
+    {
+        traces[i] = trace_open(trace_files[i]);
+    }
+    if(sweep_mode != 0)
+    {
+        if(num_traces > 1)
+        {
+            printf("%s: the sweep takes one trace\n", argv[0]);
+            return 1;
+        }
+        sweep(traces[0], s, E, b, num_threads);
+        trace_close(traces[0]);
+        return 0;
+    }
+
+    sram_cache_t *cache = sram_cache_construct(s, E, b, 0);
+    if(classify != 0)
+    {
+        sram_cache_enable_3c(cache);
+    }
+    if(write_policy >= 0)
+    {
+        sram_cache_set_write_policy(cache, write_policy, wbuf_entries);
+    }
+    if(victim_lines > 0)
+    {
+        sram_cache_enable_victim(cache, victim_lines);
+    }
+    if(partition != 0 || num_traces > 1)
+    {
+        sram_cache_enable_partition(cache);
+        for(int i = 0; partition != 0 && i < TRACE_MAX_REQUESTERS; i ++ )
+        {
+            sram_cache_set_way_mask(cache, i, way_masks[i]);
+        }
+    }
+    if(timed != 0)
+    {
+        sram_cache_enable_mshr(cache, num_mshrs, hit_latency, miss_latency);
+    }
+    if(dram_policy >= 0)
+    {
+        dram_timing_config_t config = *dram_timing_default_config();
+        config.page_policy = dram_policy;
+        dram_timing_enable(&config);
+    }
+
+    FILE *fw = NULL;
+    if(binary_file != NULL)
+    {
+        fw = fopen(binary_file, "wb");
+        if(fw == NULL)
+        {
+            printf("%s: can not open %s\n", argv[0], binary_file);
+            return 1;
+        }
+        trace_write_binary_header(fw);
+    }
+
+    static trace_record_t records[TRACE_BATCH_SIZE];
+    uint64_t count, num_records = 0;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    while((count = read_batch(traces, num_traces, records)) > 0)
+    {
+        if(fw != NULL)
+        {
+            trace_write_binary(fw, records, count);
+        }
+
+        for(uint64_t i = 0; i < count; i ++ )
+        {
+            trace_record_t *r = &records[i];
+            sram_cache_result_t res;
+
+            // cachelab ignores instruction fetch
+            if(r->op == TRACE_OP_INST)
+            {
+                continue;
+            }
+
+            if(verbose != 0)
+            {
+                printf("%c %lx,%u", trace_op_name[r->op], r->addr, r->size);
+            }
+
+            sram_cache_set_requester(cache, r->requester);
+
+            // M is a load followed by a store: the store always hits
+            res = simulate(cache, r->addr, r->size, r->op == TRACE_OP_STORE);
+            if(verbose != 0)
+            {
+                printf("%s", result_name[res]);
+            }
+            if(r->op == TRACE_OP_MODIFY)
+            {
+                res = simulate(cache, r->addr, r->size, 1);
+                if(verbose != 0)
+                {
+                    printf("%s", result_name[res]);
+                }
+            }
+
+            if(verbose != 0)
+            {
+                printf("\n");
+            }
+        }
+        num_records += count;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double seconds = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+
+    printf("hits:%lu misses:%lu evictions:%lu\n",
+        cache->stats.hit_count, cache->stats.miss_count, cache->stats.eviction_count);
+    sram_cache_print_3c(cache, stdout);
+    sram_cache_print_partition(cache, stdout);
+    if(victim_lines > 0)
+    {
+        sram_victim_stats_t *vs = sram_cache_victim_stats(cache);
+        printf("victim hits:%lu misses:%lu evictions:%lu writebacks:%lu\n",
+            vs->hit_count, vs->miss_count, vs->eviction_count, vs->writeback_count);
+    }
+    if(timed != 0)
+    {
+        sram_mshr_stats_t *ms = sram_cache_mshr_stats(cache);
+        printf("cycles:%lu stall cycles:%lu mshr full:%lu primary misses:%lu merged:%lu mlp:%.2f\n",
+            ms->cycles, ms->stall_cycles, ms->full_count, ms->primary_count, ms->secondary_count,
+            ms->busy_cycles > 0 ? (double)ms->occupancy_cycles / ms->busy_cycles : 0.0);
+    }
+    if(dram_policy >= 0)
+    {
+        // the writes still posted in the queue
+        dram_timing_drain();
+        dram_timing_print(stdout);
+    }
+    if(write_policy >= 0)
+    {
+        // what is still dirty or buffered at the end reaches DRAM as well
+        sram_cache_flush(cache);
+        sram_cache_stats_t *st = &cache->stats;
+        printf("dram read bytes:%lu write bytes:%lu write transactions:%lu\n",
+            st->dram_read_bytes, st->dram_write_bytes, st->dram_write_count);
+        if(write_policy == SRAM_WRITE_COMBINING)
+        {
+            printf("write buffer merged:%lu full:%lu\n", st->wbuf_merge_count, st->wbuf_full_count);
+        }
+    }
+    fprintf(stderr, "%lu records in %.3f s (%.1f M records/s)\n",
+        num_records, seconds, seconds > 0 ? num_records / seconds * 1e-6 : 0.0);
+
+    // the last records of the binary trace are written by fclose
+    if(fw != NULL && fclose(fw) != 0)
+    {
+        printf("%s: can not write %s\n", argv[0], binary_file);
+        return 1;
+    }
+    for(int i = 0; i < num_traces; i ++ )
+    {
+        trace_close(traces[i]);
+    }
+    sram_cache_free(cache);
+    return 0;
+}
@@ -0,0 +1,124 @@
+// tests of the SRAM cache model (sram*.c) on tag-only caches, no DRAM behind them
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/cache.h>
+
+// every miss of the cache has exactly one class
+static void check_3c_total(sram_cache_t *c)
+{
+    sram_3c_stats_t *st = sram_cache_3c_stats(c);
+    assert(st->compulsory_count + st->capacity_count + st->conflict_count == c->stats.miss_count);
+}
+
+static void Test3cConflict()
+{
+    printf("Testing 3C classification of conflict misses ...\n");
+
+    // direct mapped, 2 sets of 64 bytes lines: 0x0 and 0x80 share set 0
+    sram_cache_t *c = sram_cache_construct(1, 1, 6, 0);
+    sram_cache_enable_3c(c);
+    sram_3c_stats_t *st = sram_cache_3c_stats(c);
+
+    sram_cache_access(c, 0x0, 8, 0);
+    sram_cache_access(c, 0x80, 8, 0);
+    assert(st->compulsory_count == 2);
+
+    // the fully associative cache of 2 lines holds both
+    assert(sram_cache_access(c, 0x0, 8, 0) == SRAM_CACHE_MISS_EVICTION);
+    assert(st->conflict_count == 1 && st->conflict_per_set[0] == 1);
+
+    // 4 lines do not fit in 2 at all: 0x80 and 0x0 were pushed out by 0x40 and 0xc0
+    sram_cache_access(c, 0x40, 8, 0);
+    sram_cache_access(c, 0x80, 8, 0);
+    sram_cache_access(c, 0xc0, 8, 0);
+    sram_cache_access(c, 0x0, 8, 0);
+    assert(st->capacity_count == 2 && st->conflict_count == 1);
+    check_3c_total(c);
+
+    sram_cache_free(c);
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// a store miss which does not allocate leaves the line out of the cache, and of the shadow too
+static void check_3c_store_miss(sram_write_policy_t policy)
+{
+    sram_cache_t *c = sram_cache_construct(1, 1, 6, 0);
+    sram_cache_set_write_policy(c, policy, 4);
+    sram_cache_enable_3c(c);
+    sram_3c_stats_t *st = sram_cache_3c_stats(c);
+
+    assert(sram_cache_access(c, 0x0, 8, 1) == SRAM_CACHE_MISS);
+    assert(st->compulsory_count == 1);
+
+    // the first read still misses, since the store did not fill the line
+    if(policy == SRAM_WRITE_BACK)
+    {
+        assert(sram_cache_access(c, 0x0, 8, 0) == SRAM_CACHE_HIT);
+    }
+    else
+    {
+        assert(sram_cache_access(c, 0x0, 8, 0) == SRAM_CACHE_MISS);
+        assert(st->compulsory_count == 2);
+    }
+    assert(st->conflict_count == 0);
+    check_3c_total(c);
+
+    sram_cache_free(c);
+}
+
+static void Test3cStoreMiss()
+{
+    printf("Testing 3C classification of store misses ...\n");
+
+    check_3c_store_miss(SRAM_WRITE_BACK);
+    check_3c_store_miss(SRAM_WRITE_THROUGH);
+    check_3c_store_miss(SRAM_WRITE_COMBINING);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestMshrRefill()
+{
+    printf("Testing MSHRs of lines refilled while pending ...\n");
+
+    // one line: each miss evicts the line of the one before
+    sram_cache_t *c = sram_cache_construct(0, 1, 6, 0);
+    sram_cache_enable_mshr(c, 4, 1, 100);
+    sram_mshr_stats_t *st = sram_cache_mshr_stats(c);
+    uint64_t cycle, done;
+
+    cycle = 0;
+    sram_cache_access_at(c, 0x0, 8, 0, &cycle, &done);
+    assert(done == 101);
+    cycle = 1;
+    sram_cache_access_at(c, 0x40, 8, 0, &cycle, &done);
+    assert(done == 102);
+
+    // 0x0 is read from DRAM a second time: it waits for its own fill, not the first one
+    cycle = 2;
+    sram_cache_access_at(c, 0x0, 8, 0, &cycle, &done);
+    assert(done == 103);
+    assert(st->primary_count == 3 && st->secondary_count == 0);
+    assert(c->stats.dram_read_bytes == 3 * 64);
+
+    // the next load of 0x0 hits its pending MSHR
+    cycle = 3;
+    sram_cache_access_at(c, 0x0, 8, 0, &cycle, &done);
+    assert(done == 103 && st->secondary_count == 1);
+
+    sram_cache_free(c);
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+int main()
+{
+    Test3cConflict();
+    Test3cStoreMiss();
+    TestMshrRefill();
+
+    return 0;
+}
@@ -0,0 +1,653 @@
+// tests of the address translation and of the memory behind it (mmu.c, pgtable.c, dram.c, swap.c)
+// every test builds its own address spaces in a fresh physical memory and frees them at the end
+// swap files go to ../files/swap: run from ./bin (make mmu)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <headers/common.h>
+#include <headers/cpu.h>
+#include <headers/memory.h>
+#include <headers/cache.h>
+
+// a new empty address space, made current: its tables come on demand with the first faults
+static page_table_arena_t *address_space_construct()
+{
+    page_table_arena_t *a = page_table_arena_construct();
+    page_table_arena_switch(a);
+    mmu_write_cr3(0);
+    return a;
+}
+
+static void address_space_switch(page_table_arena_t *a, uint64_t cr3)
+{
+    page_table_arena_switch(a);
+    mmu_write_cr3(cr3);
+}
+
+static void TestBulkCoherence()
+{
+    printf("Testing bulk copies around the SRAM cache ...\n");
+
+    physical_memory_init(64 * PHYSICAL_PAGE_SIZE);
+    page_table_arena_t *a = address_space_construct();
+
+    // a store still in the cache is seen by the copy
+    va_write64(0x400000, 0x1234);
+    uint64_t value = 0;
+    va_copy_from(&value, 0x400000, sizeof(value));
+    assert(value == 0x1234);
+
+    // a copy over a cached line is seen by the next load
+    assert(va_read64(0x400008) == 0);
+    value = 0x5678;
+    va_copy_to(0x400008, &value, sizeof(value));
+    assert(va_read64(0x400008) == 0x5678);
+
+    va_set(0x400000, 0xff, 16);
+    assert(va_read64(0x400000) == 0xffffffffffffffff);
+    assert(va_read64(0x400008) == 0xffffffffffffffff);
+
+    mmu_free_address_space(a);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestTlbReplacement()
+{
+    printf("Testing TLB hit, miss and LRU replacement ...\n");
+
+    // 2 sets of 2 ways: the even vpns go to set 0
+    tlb_t *tlb = tlb_construct(1, 2);
+    uint64_t ppn = 0;
+
+    assert(tlb_lookup(tlb, 0, &ppn) == 0);
+    tlb_insert(tlb, 0, 100);
+    tlb_insert(tlb, 2, 102);
+    tlb_insert(tlb, 1, 101);
+
+    // vpn 2 is the LRU entry of set 0 after this hit, the next fill of the set takes it
+    assert(tlb_lookup(tlb, 0, &ppn) == 1 && ppn == 100);
+    tlb_insert(tlb, 4, 104);
+    assert(tlb->stats.eviction_count == 1);
+    assert(tlb_lookup(tlb, 2, &ppn) == 0);
+    assert(tlb_lookup(tlb, 0, &ppn) == 1 && ppn == 100);
+    assert(tlb_lookup(tlb, 4, &ppn) == 1 && ppn == 104);
+    assert(tlb_lookup(tlb, 1, &ppn) == 1 && ppn == 101);
+
+    // INVLPG drops one page, the flush all of them
+    tlb_invalidate(tlb, 0);
+    assert(tlb_lookup(tlb, 0, &ppn) == 0);
+    assert(tlb_lookup(tlb, 4, &ppn) == 1);
+    tlb_flush(tlb);
+    assert(tlb_lookup(tlb, 1, &ppn) == 0);
+    assert(tlb_lookup(tlb, 4, &ppn) == 0);
+
+    assert(tlb->stats.hit_count == 5);
+    assert(tlb->stats.miss_count == 5);
+    assert(tlb->stats.invalidate_count == 1);
+    assert(tlb->stats.flush_count == 1);
+
+    tlb_free(tlb);
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestStlbFill()
+{
+    printf("Testing the STLB behind the iTLB and dTLB ...\n");
+
+    physical_memory_init(64 * PHYSICAL_PAGE_SIZE);
+    page_table_arena_t *a = address_space_construct();
+
+    // 5 pages in one set of the 4-way dTLB (16 sets), and in 5 sets of the STLB
+    uint64_t stride = 16 * PHYSICAL_PAGE_SIZE;
+    for(int i = 0; i < 5; i ++ )
+    {
+        va_write64(0x400000 + i * stride, i);
+    }
+    mmu_stats_t before = mmu_stats;
+
+    // the first page left the dTLB, the STLB has it and fills the dTLB again
+    uint64_t paddr = va2pa(0x400000);
+    assert(mmu_stats.walk_count == before.walk_count);
+    assert(mmu_stats.hit_counts[MMU_DTLB] == before.hit_counts[MMU_DTLB]);
+    assert(mmu_stats.hit_counts[MMU_STLB] == before.hit_counts[MMU_STLB] + 1);
+    assert(va2pa(0x400000) == paddr);
+    assert(mmu_stats.hit_counts[MMU_DTLB] == before.hit_counts[MMU_DTLB] + 1);
+
+    // the iTLB misses the page once and is filled from the STLB too
+    assert(va2pa_inst(0x400008) == paddr + 8);
+    assert(va2pa_inst(0x400010) == paddr + 16);
+    assert(mmu_stats.hit_counts[MMU_ITLB] == before.hit_counts[MMU_ITLB] + 1);
+    assert(mmu_stats.hit_counts[MMU_STLB] == before.hit_counts[MMU_STLB] + 2);
+    assert(mmu_stats.walk_count == before.walk_count);
+
+    mmu_free_address_space(a);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestHugePageFallback()
+{
+    printf("Testing the fallback of huge pages to smaller pages ...\n");
+
+    // 768 pages: no 1GB page, a single 2MB page
+    physical_memory_init(768 * PHYSICAL_PAGE_SIZE);
+    mmu_request_huge_pages(0x80000000, 0x40000000, PAGE_1G);
+    mmu_request_huge_pages(0x40000000, 0x400000, PAGE_2M);
+    page_table_arena_t *a = address_space_construct();
+
+    // the 1GB region falls back to a 2MB page at ppn 0
+    va_write64(0x80001008, 0x1234);
+    uint64_t paddr = va2pa(0x80000000);
+    assert(paddr == 0 && page_map[0].huge == 1 && page_map[511].huge == 1);
+    assert(va2pa(0x801ff000) == paddr + 0x1ff000);
+#if USE_TLB_HARDWARE
+    assert(mmu_tlb(MMU_DTLB, PAGE_2M)->stats.hit_count > 0);
+#endif
+    assert(va_read64(0x80001008) == 0x1234);
+
+    // 256 free pages left: the 2MB region falls back to 4KB pages
+    va_write64(0x40000000, 0x5678);
+    va_write64(0x40001000, 0x9abc);
+    uint64_t ppn = va2pa(0x40000000) >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    assert(ppn >= 512 && page_map[ppn].huge == 0 && page_map[ppn].allocated == 1);
+    assert(va_read64(0x40000000) == 0x5678);
+    assert(va_read64(0x40001000) == 0x9abc);
+
+    mmu_free_address_space(a);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// the accessed bits of TestClockOrder, tested and cleared like page_referenced() of mmu.c
+static int accessed_bits[8];
+
+static int test_and_clear_accessed(uint64_t ppn)
+{
+    int accessed = accessed_bits[ppn];
+    accessed_bits[ppn] = 0;
+    return accessed;
+}
+
+static void TestClockOrder()
+{
+    printf("Testing the eviction order of CLOCK ...\n");
+
+    physical_memory_init(8 * PHYSICAL_PAGE_SIZE);
+    memset(accessed_bits, 0, sizeof(accessed_bits));
+
+    // the free pages in order, all mapped: the inactive list is 0 .. 7
+    for(uint64_t i = 0; i < 8; i ++ )
+    {
+        assert(page_alloc(0) == i);
+        page_lru_add(i);
+    }
+    assert(page_alloc(0) == -1);
+
+    // 0 and 1 were accessed: a second chance on the active list, 2 is the victim
+    accessed_bits[0] = 1;
+    accessed_bits[1] = 1;
+    assert(page_reclaim(0, test_and_clear_accessed) == 2);
+    assert(page_reclaim(0, test_and_clear_accessed) == 3);
+    accessed_bits[4] = 1;
+    assert(page_reclaim(0, test_and_clear_accessed) == 5);
+
+    // active 0 1 4 is longer than inactive 6 7: 0 is aged back to the inactive tail
+    assert(page_reclaim(0, test_and_clear_accessed) == 6);
+    assert(page_reclaim(0, test_and_clear_accessed) == 7);
+
+    // active 1 4 against inactive 0: 1 was accessed again and rotates, 4 is aged
+    accessed_bits[1] = 1;
+    assert(page_reclaim(0, test_and_clear_accessed) == 0);
+    assert(page_reclaim(0, test_and_clear_accessed) == 4);
+
+    page_alloc_stats_t *stats = page_alloc_stats();
+    assert(stats->reclaim_count == 7);
+    assert(stats->activate_count == 3);
+    assert(stats->deactivate_count == 2);
+    assert(stats->rotate_count == 1);
+
+    // the victims were never mapped for real: nothing to release
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestReclaimCoherence()
+{
+    printf("Testing page reclaim with the stores in the SRAM cache ...\n");
+
+    // 20 pages over 16 frames: the last stores of the victims are dirty lines of the cache
+    physical_memory_init(16 * PHYSICAL_PAGE_SIZE);
+    page_table_arena_t *a = address_space_construct();
+    page_fault_stats_t before = page_fault_stats;
+
+    for(int i = 0; i < 20; i ++ )
+    {
+        va_write64(0x400000 + i * PHYSICAL_PAGE_SIZE, 0x1000 + i);
+    }
+    for(int i = 0; i < 20; i ++ )
+    {
+        assert(va_read64(0x400000 + i * PHYSICAL_PAGE_SIZE) == 0x1000 + i);
+    }
+    assert(page_fault_stats.swap_out_count > before.swap_out_count);
+    assert(page_fault_stats.major_count > before.major_count);
+
+    mmu_free_address_space(a);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+// write the pages, then read them back in order with readahead and fault-around
+static void check_readahead_scan(int num_pages, int readahead, int fault_around)
+{
+    mmu_set_swap_readahead(readahead);
+    mmu_set_fault_around(fault_around);
+    for(int i = 0; i < num_pages; i ++ )
+    {
+        assert(va_read64(0x400000 + i * PHYSICAL_PAGE_SIZE) == 0x2000 + i);
+    }
+    mmu_set_swap_readahead(0);
+    mmu_set_fault_around(0);
+}
+
+static void TestReadaheadUnderPressure()
+{
+    printf("Testing swap readahead under memory pressure ...\n");
+
+    // 56 pages over 16 frames
+    physical_memory_init(16 * PHYSICAL_PAGE_SIZE);
+    page_table_arena_t *a = address_space_construct();
+    for(int i = 0; i < 56; i ++ )
+    {
+        va_write64(0x400000 + i * PHYSICAL_PAGE_SIZE, 0x2000 + i);
+    }
+    uint64_t cr3_a = cpu_controls.cr3;
+
+    // no free page: readahead reads nothing, the faulting pages are intact
+    page_fault_stats_t before = page_fault_stats;
+    check_readahead_scan(56, 15, 0);
+    check_readahead_scan(56, 16, 4);
+    assert(page_fault_stats.readahead_count == before.readahead_count);
+
+    // another address space takes 8 frames from a and frees them: the readahead takes them
+    page_table_arena_t *b = address_space_construct();
+    for(int i = 0; i < 8; i ++ )
+    {
+        va_write64(0x400000 + i * PHYSICAL_PAGE_SIZE, i);
+    }
+    mmu_free_address_space(b);
+    page_table_arena_switch(a);
+    mmu_write_cr3(cr3_a);
+
+    before = page_fault_stats;
+    check_readahead_scan(56, 15, 4);
+    assert(page_fault_stats.readahead_count > before.readahead_count);
+    assert(page_fault_stats.readahead_count <= before.readahead_count + 8);
+    assert(page_fault_stats.readahead_hit_count > before.readahead_hit_count);
+    check_readahead_scan(56, 16, 4);
+
+    mmu_free_address_space(a);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestAsidReuse()
+{
+    printf("Testing the reuse of ASIDs ...\n");
+
+    physical_memory_init(64 * PHYSICAL_PAGE_SIZE);
+    mmu_set_num_asids(2);
+
+    page_table_arena_t *spaces[3];
+    uint64_t cr3s[3];
+    int asids[3];
+    for(int i = 0; i < 2; i ++ )
+    {
+        spaces[i] = address_space_construct();
+        va_write64(0x400000, 0x3000 + i);
+        cr3s[i] = cpu_controls.cr3;
+        asids[i] = mmu_current_asid();
+    }
+    assert(asids[0] != asids[1]);
+
+    // back to the first space: its ASID kept its entries, no walk
+    mmu_stats_t before = mmu_stats;
+    address_space_switch(spaces[0], cr3s[0]);
+    assert(mmu_current_asid() == asids[0]);
+    assert(va_read64(0x400000) == 0x3000);
+    assert(mmu_stats.walk_count == before.walk_count);
+    assert(mmu_stats.flush_avoided_count == before.flush_avoided_count + 1);
+
+    // the same CR3 again avoids no flush
+    mmu_write_cr3(cr3s[0]);
+    assert(mmu_current_asid() == asids[0]);
+    assert(mmu_stats.flush_avoided_count == before.flush_avoided_count + 1);
+
+    address_space_switch(spaces[1], cr3s[1]);
+    assert(mmu_stats.flush_avoided_count == before.flush_avoided_count + 2);
+
+    // a third space takes the LRU ASID, of the first space, which is flushed
+    spaces[2] = address_space_construct();
+    va_write64(0x400000, 0x3002);
+    cr3s[2] = cpu_controls.cr3;
+    assert(mmu_current_asid() == asids[0]);
+    assert(mmu_stats.asid_flush_count == before.asid_flush_count + 1);
+
+    // the first space walks again under the ASID of the second, now the LRU one
+    before = mmu_stats;
+    address_space_switch(spaces[0], cr3s[0]);
+    assert(mmu_current_asid() == asids[1]);
+    assert(va_read64(0x400000) == 0x3000);
+    assert(mmu_stats.walk_count == before.walk_count + 1);
+    assert(mmu_stats.flush_avoided_count == before.flush_avoided_count);
+
+    address_space_switch(spaces[2], cr3s[2]);
+    assert(va_read64(0x400000) == 0x3002);
+    address_space_switch(spaces[1], cr3s[1]);
+    assert(va_read64(0x400000) == 0x3001);
+
+    // CR3 0 and back is a plain switch: CR3 0 took the ASID of the third space, not of this one
+    mmu_write_cr3(0);
+    before = mmu_stats;
+    address_space_switch(spaces[1], cr3s[1]);
+    assert(mmu_current_asid() == asids[1]);
+    assert(va_read64(0x400000) == 0x3001);
+    assert(mmu_stats.walk_count == before.walk_count);
+    assert(mmu_stats.flush_avoided_count == before.flush_avoided_count + 1);
+
+    for(int i = 0; i < 3; i ++ )
+    {
+        mmu_free_address_space(spaces[i]);
+    }
+    mmu_set_num_asids(6);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestShootdown()
+{
+    printf("Testing the TLB shootdowns, their batches and ceiling ...\n");
+
+    // one address space on 3 cores: all of them cache the 8 pages of memory
+    physical_memory_init(8 * PHYSICAL_PAGE_SIZE);
+    mmu_set_num_cores(3);
+    page_table_arena_t *a = address_space_construct();
+    for(int i = 0; i < 8; i ++ )
+    {
+        va_write64(0x400000 + i * PHYSICAL_PAGE_SIZE, 0x4000 + i);
+    }
+    uint64_t cr3 = cpu_controls.cr3;
+    for(int id = 1; id < 3; id ++ )
+    {
+        mmu_switch_core(id);
+        address_space_switch(a, cr3);
+        for(int i = 0; i < 8; i ++ )
+        {
+            assert(va_read64(0x400000 + i * PHYSICAL_PAGE_SIZE) == 0x4000 + i);
+        }
+    }
+    mmu_switch_core(0);
+    assert(cpu_controls.cr3 == cr3);
+
+    // ceiling 0: the page evicted by the fault flushes the TLBs of both other cores
+    mmu_shootdown_stats_t before = mmu_shootdown_stats;
+    mmu_set_shootdown_ceiling(0);
+    va_write64(0x400000 + 8 * PHYSICAL_PAGE_SIZE, 0x4008);
+    assert(mmu_shootdown_stats.batch_count == before.batch_count + 1);
+    assert(mmu_shootdown_stats.ipi_count == before.ipi_count + 2);
+    assert(mmu_shootdown_stats.flush_count == before.flush_count + 2);
+    assert(mmu_shootdown_stats.invalidate_count == before.invalidate_count);
+
+    // under the ceiling: the next victim is invalidated page by page
+    before = mmu_shootdown_stats;
+    mmu_set_shootdown_ceiling(33);
+    va_write64(0x400000 + 9 * PHYSICAL_PAGE_SIZE, 0x4009);
+    assert(mmu_shootdown_stats.batch_count == before.batch_count + 1);
+    assert(mmu_shootdown_stats.ipi_count == before.ipi_count + 2);
+    assert(mmu_shootdown_stats.flush_count == before.flush_count);
+    assert(mmu_shootdown_stats.invalidate_count == before.invalidate_count + 2);
+    assert(mmu_shootdown_stats.initiator_cycles > before.initiator_cycles);
+
+    // the other cores leave the space, their TLBs keep its ASID until the teardown
+    for(int id = 1; id < 3; id ++ )
+    {
+        mmu_switch_core(id);
+        address_space_switch(NULL, 0);
+    }
+    mmu_switch_core(0);
+
+    // one request per core, sent together in one batch
+    before = mmu_shootdown_stats;
+    mmu_free_address_space(a);
+    assert(mmu_shootdown_stats.request_count == before.request_count + 2);
+    assert(mmu_shootdown_stats.batch_count == before.batch_count + 1);
+    assert(mmu_shootdown_stats.ipi_count == before.ipi_count + 2);
+
+    // the same without batching: one round per request
+    mmu_set_shootdown_batch(1);
+    a = address_space_construct();
+    va_write64(0x400000, 1);
+    cr3 = cpu_controls.cr3;
+    for(int id = 1; id < 3; id ++ )
+    {
+        mmu_switch_core(id);
+        address_space_switch(a, cr3);
+        assert(va_read64(0x400000) == 1);
+        address_space_switch(NULL, 0);
+    }
+    mmu_switch_core(0);
+    before = mmu_shootdown_stats;
+    mmu_free_address_space(a);
+    assert(mmu_shootdown_stats.batch_count == before.batch_count + 2);
+    assert(mmu_shootdown_stats.ipi_count == before.ipi_count + 2);
+
+    mmu_set_shootdown_batch(32);
+    mmu_set_num_cores(1);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static int node_of_vaddr(uint64_t vaddr)
+{
+    return numa_node_of(va2pa(vaddr) >> PHYSICAL_PAGE_OFFSET_LENGTH);
+}
+
+static void TestNumaPlacement()
+{
+    printf("Testing the NUMA placement of the faulted pages ...\n");
+
+    // 2 nodes of 4 pages: ppn 0 - 3 and ppn 4 - 7
+    physical_memory_init(8 * PHYSICAL_PAGE_SIZE);
+    numa_init(2, 100, 300);
+    page_table_arena_t *a = address_space_construct();
+    uint64_t v = 0x400000;
+
+    // interleave: the even virtual pages on node 0, the odd ones on node 1
+    numa_set_policy(NUMA_INTERLEAVE, 0);
+    for(int i = 0; i < 4; i ++ )
+    {
+        va_write64(v + i * PHYSICAL_PAGE_SIZE, i);
+        assert(node_of_vaddr(v + i * PHYSICAL_PAGE_SIZE) == i % 2);
+    }
+
+    // first-touch: the node of the core, the other node when it is full
+    numa_set_policy(NUMA_FIRST_TOUCH, 0);
+    numa_current_node = 1;
+    for(int i = 4; i < 7; i ++ )
+    {
+        va_write64(v + i * PHYSICAL_PAGE_SIZE, i);
+    }
+    assert(node_of_vaddr(v + 4 * PHYSICAL_PAGE_SIZE) == 1);
+    assert(node_of_vaddr(v + 5 * PHYSICAL_PAGE_SIZE) == 1);
+    assert(node_of_vaddr(v + 6 * PHYSICAL_PAGE_SIZE) == 0);
+    numa_current_node = 0;
+    va_write64(v + 7 * PHYSICAL_PAGE_SIZE, 7);
+    assert(node_of_vaddr(v + 7 * PHYSICAL_PAGE_SIZE) == 0);
+    assert(numa_nodes[0].allocated_count == 4 && numa_nodes[1].allocated_count == 4);
+
+    // bind: a full node 1 replaces its own pages, the pages of node 0 stay where they are
+    uint64_t paddrs[8];
+    for(int i = 0; i < 8; i ++ )
+    {
+        paddrs[i] = va2pa(v + i * PHYSICAL_PAGE_SIZE);
+    }
+    numa_set_policy(NUMA_BIND, 1);
+    for(int i = 8; i < 10; i ++ )
+    {
+        va_write64(v + i * PHYSICAL_PAGE_SIZE, i);
+        assert(node_of_vaddr(v + i * PHYSICAL_PAGE_SIZE) == 1);
+    }
+    for(int i = 0; i < 8; i ++ )
+    {
+        if(numa_node_of(paddrs[i] >> PHYSICAL_PAGE_OFFSET_LENGTH) == 0)
+        {
+            assert(va2pa(v + i * PHYSICAL_PAGE_SIZE) == paddrs[i]);
+        }
+    }
+    for(int i = 0; i < 10; i ++ )
+    {
+        assert(va_read64(v + i * PHYSICAL_PAGE_SIZE) == i);
+    }
+
+    numa_set_policy(NUMA_FIRST_TOUCH, 0);
+    mmu_free_address_space(a);
+    numa_init(1, 0, 0);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestDemandPageTables()
+{
+    printf("Testing the page tables allocated on demand ...\n");
+
+    physical_memory_init(64 * PHYSICAL_PAGE_SIZE);
+    page_table_arena_t *a = address_space_construct();
+    page_table_stats_t *stats = page_table_stats(a);
+    for(int i = 0; i < NUM_PAGE_TABLE_LEVELS; i ++ )
+    {
+        assert(stats->table_counts[i] == 0);
+    }
+
+    // the counts of pgd, pud, pmd and pt after each fault
+    uint64_t vaddrs[5] = {
+        0x400000,           // all the levels
+        0x401000,           // the same page table
+        0x600000,           // the next 2MB: a page table
+        0x100400000,        // the 5th GB: a pmd and a page table
+        0x8000400000,       // the 2nd 512GB: a pud, a pmd and a page table
+    };
+    uint64_t counts[5][NUM_PAGE_TABLE_LEVELS] = {
+        {1, 1, 1, 1},
+        {1, 1, 1, 1},
+        {1, 1, 1, 2},
+        {1, 1, 2, 3},
+        {1, 2, 3, 4},
+    };
+    for(int k = 0; k < 5; k ++ )
+    {
+        va_write64(vaddrs[k], k);
+        for(int i = 0; i < NUM_PAGE_TABLE_LEVELS; i ++ )
+        {
+            assert(stats->table_counts[i] == counts[k][i]);
+        }
+    }
+    for(int k = 0; k < 5; k ++ )
+    {
+        assert(va_read64(vaddrs[k]) == k);
+    }
+
+    mmu_free_address_space(a);
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+static void TestAddressSpaceTeardown()
+{
+    printf("Testing the teardown of an address space ...\n");
+
+    physical_memory_init(1024 * PHYSICAL_PAGE_SIZE);
+    mmu_request_huge_pages(0x40000000, 0x200000, PAGE_2M);
+
+    page_table_arena_t *a = address_space_construct();
+    for(int i = 0; i < 8; i ++ )
+    {
+        va_write64(0x400000 + i * PHYSICAL_PAGE_SIZE, i);
+    }
+    uint64_t cr3_a = cpu_controls.cr3;
+
+    // 8 pages and a huge page of 512 pages, which only fits at ppn 512
+    page_table_arena_t *b = address_space_construct();
+    for(int i = 0; i < 8; i ++ )
+    {
+        va_write64(0x400000 + i * PHYSICAL_PAGE_SIZE, 100 + i);
+    }
+    va_write64(0x40000000, 0x5678);
+    uint64_t ppn_b = va2pa(0x400000) >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    uint64_t ppn_huge = va2pa(0x40000000) >> PHYSICAL_PAGE_OFFSET_LENGTH;
+    assert(ppn_huge == 512 && page_map[ppn_huge].huge == 1);
+
+    // the tables, the 4KB pages and the huge page of b are free, a keeps its own
+    mmu_free_address_space(b);
+    assert(page_is_free(ppn_b) == 1);
+    for(uint64_t i = 0; i < 512; i ++ )
+    {
+        assert(page_map[ppn_huge + i].huge == 0 && page_is_free(ppn_huge + i) == 1);
+    }
+
+    page_table_arena_switch(a);
+    mmu_write_cr3(cr3_a);
+    for(int i = 0; i < 8; i ++ )
+    {
+        assert(va_read64(0x400000 + i * PHYSICAL_PAGE_SIZE) == i);
+    }
+    assert(page_is_free(va2pa(0x400000) >> PHYSICAL_PAGE_OFFSET_LENGTH) == 0);
+
+    // the frames of the huge page make one again
+    page_table_arena_t *c = address_space_construct();
+    assert(va_read64(0x40000000) == 0);
+    assert(va2pa(0x40000000) >> PHYSICAL_PAGE_OFFSET_LENGTH == ppn_huge);
+
+    mmu_free_address_space(c);
+    mmu_free_address_space(a);
+    // no page left allocated
+    physical_memory_free();
+
+    printf("\033[32;1m\tPass\033[0m\n");
+}
+
+int main()
+{
+    TestBulkCoherence();
+    TestTlbReplacement();
+#if USE_TLB_HARDWARE
+    // the counters of the modelled TLBs, functional simulation has none
+    TestStlbFill();
+    TestAsidReuse();
+    TestShootdown();
+#endif
+    TestHugePageFallback();
+    TestClockOrder();
+    TestReclaimCoherence();
+    TestReadaheadUnderPressure();
+    TestNumaPlacement();
+    TestDemandPageTables();
+    TestAddressSpaceTeardown();
+
+    finally_cleanup();
+
+    return 0;
+}